@@ -0,0 +1,183 @@
+#include <inc/x86.h>
+
+#include <boot/boot.h>
+
+// AHCI (SATA) disk reads, for machines such as QEMU's q35 that have no
+// legacy IDE ports at all.  The controller is driven through memory-
+// mapped registers at ABAR (BAR5); a command is a frame describing the
+// ATA command plus a scatter list (PRD table), so one READ DMA EXT can
+// move up to AHCI_MAXSECTS sectors.
+//
+// We use command slot 0 of the first port with an ATA disk attached,
+// and poll for completion.  ahci_read() returns -1 whenever AHCI is
+// unavailable or a command fails; the caller then falls back to IDE.
+
+// Generic host control registers
+#define HBA_GHC		0x04
+#define HBA_GHC_AE	0x80000000	// AHCI enable
+#define HBA_PI		0x0C		// ports implemented
+
+// Port registers, relative to ABAR + 0x100 + port * 0x80
+#define PX_CLB		0x00		// command list base
+#define PX_CLBU		0x04
+#define PX_FB		0x08		// received FIS base
+#define PX_FBU		0x0C
+#define PX_IS		0x10		// interrupt status (w1c)
+#define PX_IS_TFES	0x40000000	// task file error
+#define PX_IE		0x14
+#define PX_CMD		0x18
+#define PX_CMD_ST	0x0001		// start processing the command list
+#define PX_CMD_FRE	0x0010		// FIS receive enable
+#define PX_CMD_FR	0x4000		// FIS receive running
+#define PX_CMD_CR	0x8000		// command list running
+#define PX_TFD		0x20		// task file data (ATA status)
+#define PX_SIG		0x24
+#define PX_SIG_ATA	0x00000101
+#define PX_SSTS		0x28
+#define PX_SSTS_DET	0x0F
+#define PX_SERR		0x30		// (w1c)
+#define PX_CI		0x38		// command issue
+
+#define FIS_H2D		0x27		// register FIS, host to device
+#define FIS_H2D_CMD	0x80		// the FIS carries a command
+
+// Command header: one per slot in the command list.
+struct Cmdhdr {
+  uint16_t flags;		// command FIS length in dwords, in bits 0-4
+  uint16_t prdtl;		// PRD table entries
+  uint32_t prdbc;		// bytes transferred
+  uint32_t ctba;		// command table base
+  uint32_t ctbau;
+  uint32_t reserved[4];
+};
+
+// Physical region descriptor.  'dbc' is the byte count less one.
+struct Ahciprd {
+  uint32_t dba;
+  uint32_t dbau;
+  uint32_t reserved;
+  uint32_t dbc;
+};
+
+// Command table: the command FIS, then the PRD table.
+struct Cmdtbl {
+  uint8_t cfis[64];
+  uint8_t acmd[16];
+  uint8_t reserved[48];
+  struct Ahciprd prd[1];
+};
+
+static struct Cmdhdr cmdlist[32] __attribute__((aligned(1024)));
+static uint8_t rfis[256] __attribute__((aligned(256)));
+static struct Cmdtbl cmdtbl __attribute__((aligned(128)));
+static volatile uint32_t *port;	// NULL if there is no usable disk
+
+static inline uint32_t
+preg(int reg)
+{
+  return port[reg / 4];
+}
+
+static inline void
+preg_write(int reg, uint32_t v)
+{
+  port[reg / 4] = v;
+}
+
+int
+ahci_init(void)
+{
+  volatile uint32_t *hba, *p;
+  uint32_t tag, pi;
+  int i;
+
+  if (!(tag = pci_find_class(0x01, 0x06)))      // mass storage, SATA
+    return -1;
+  hba = (volatile uint32_t *) (pci_conf_read(tag, 0x24) & ~0xF);
+  if (!hba)
+    return -1;
+  // enable memory space decoding and bus mastering
+  pci_conf_write(tag, 0x04, pci_conf_read(tag, 0x04) | 0x06);
+  hba[HBA_GHC / 4] |= HBA_GHC_AE;
+
+  // find a port with a device present (DET = 3) that is an ATA disk
+  pi = hba[HBA_PI / 4];
+  for (i = 0; i < 32; i++) {
+    if (!(pi & (1 << i)))
+      continue;
+    p = hba + (0x100 + i * 0x80) / 4;
+    if ((p[PX_SSTS / 4] & PX_SSTS_DET) == 3 && p[PX_SIG / 4] == PX_SIG_ATA)
+      break;
+  }
+  if (i == 32)
+    return -1;
+  port = p;
+
+  // Stop the port (the BIOS may have left it running on its own
+  // command list), point it at ours and restart it.
+  preg_write(PX_CMD, preg(PX_CMD) & ~PX_CMD_ST);
+  while (preg(PX_CMD) & PX_CMD_CR)
+    /* do nothing */ ;
+  preg_write(PX_CMD, preg(PX_CMD) & ~PX_CMD_FRE);
+  while (preg(PX_CMD) & PX_CMD_FR)
+    /* do nothing */ ;
+
+  cmdlist[0].flags = 5;                 // 20-byte command FIS, read
+  cmdlist[0].prdtl = 1;
+  cmdlist[0].ctba = (uint32_t) &cmdtbl;
+  preg_write(PX_CLB, (uint32_t) cmdlist);
+  preg_write(PX_CLBU, 0);
+  preg_write(PX_FB, (uint32_t) rfis);
+  preg_write(PX_FBU, 0);
+  preg_write(PX_IE, 0);
+  preg_write(PX_SERR, ~0);
+  preg_write(PX_IS, ~0);
+  preg_write(PX_CMD, preg(PX_CMD) | PX_CMD_FRE);
+  preg_write(PX_CMD, preg(PX_CMD) | PX_CMD_ST);
+  return 0;
+}
+
+// Read up to 'nsect' sectors starting at sector 'offset' into physical
+// address 'dst' with one READ DMA EXT command.  Returns the number of
+// sectors read (at most AHCI_MAXSECTS), or -1.
+int
+ahci_read(void *dst, uint32_t offset, uint32_t nsect)
+{
+  uint8_t *fis = cmdtbl.cfis;
+
+  if (!port)
+    return -1;
+  if (nsect > AHCI_MAXSECTS)
+    nsect = AHCI_MAXSECTS;
+
+  cmdlist[0].prdbc = 0;
+  cmdtbl.prd[0].dba = (uint32_t) dst;
+  cmdtbl.prd[0].dbau = 0;
+  cmdtbl.prd[0].dbc = nsect * SECTSIZE - 1;
+
+  fis[0] = FIS_H2D;
+  fis[1] = FIS_H2D_CMD;
+  fis[2] = ATA_READ_DMA_EXT;
+  fis[4] = offset;
+  fis[5] = offset >> 8;
+  fis[6] = offset >> 16;
+  fis[7] = 0x40;                        // LBA
+  fis[8] = offset >> 24;
+  fis[9] = 0;
+  fis[10] = 0;
+  fis[12] = nsect;
+  fis[13] = nsect >> 8;
+
+  preg_write(PX_IS, ~0);
+  preg_write(PX_CI, 1);
+  while ((preg(PX_CI) & 1) && !(preg(PX_IS) & PX_IS_TFES))
+    /* do nothing */ ;
+
+  // status ERR or DF
+  if ((preg(PX_IS) & PX_IS_TFES) || (preg(PX_TFD) & 0x21)) {
+    // don't try again
+    port = NULL;
+    return -1;
+  }
+  return nsect;
+}
@@ -0,0 +1,39 @@
+#ifndef JOS_BOOT_BOOT_H
+#define JOS_BOOT_BOOT_H
+
+// Definitions shared by the pieces of the stage 2 boot loader.
+
+#include <inc/types.h>
+
+#define SECTSIZE	512
+#define MAXSECTS	256	// most sectors one ATA read command can move
+
+// ATA read commands, in 28-bit LBA and LBA48 forms
+#define ATA_READ		0x20	// READ SECTORS
+#define ATA_READ_EXT		0x24	// READ SECTORS EXT
+#define ATA_READ_DMA		0xC8	// READ DMA
+#define ATA_READ_DMA_EXT	0x25	// READ DMA EXT
+#define ATA_LBA28_MAX		(1 << 28)	// sectors reachable without LBA48
+
+// main.c
+void waitdisk(void);
+void ata_cmd(uint32_t offset, uint32_t nsect, uint8_t cmd, uint8_t cmd48);
+void readsects(void *dst, uint32_t offset, uint32_t nsect);
+
+// pci.c
+// A PCI function is named by its config-space address,
+// 0x80000000 | bus << 16 | dev << 11 | func << 8.
+uint32_t pci_conf_read(uint32_t tag, uint32_t off);
+void pci_conf_write(uint32_t tag, uint32_t off, uint32_t v);
+uint32_t pci_find_class(uint32_t class, uint32_t subclass);
+
+// idedma.c
+int idedma_init(void);
+int idedma_read(void *dst, uint32_t offset, uint32_t nsect);
+
+// ahci.c
+#define AHCI_MAXSECTS	8192	// 4MB, what one PRD entry can describe
+int ahci_init(void);
+int ahci_read(void *dst, uint32_t offset, uint32_t nsect);
+
+#endif /* !JOS_BOOT_BOOT_H */
@@ -0,0 +1,104 @@
+#include <inc/x86.h>
+
+#include <boot/boot.h>
+
+// Bus-master IDE DMA for the primary channel of a PIIX-style PCI IDE
+// controller.  Instead of one port read per dword, the controller
+// writes whole commands' worth of sectors straight to memory, as
+// described by a table of physical regions (PRD table).
+//
+// idedma_read() returns -1 whenever DMA is unavailable or a transfer
+// fails; the caller then falls back to PIO with readsects().
+
+// Bus master registers, relative to BAR4 of the controller
+#define BM_CMD		0
+#define BM_CMD_START	0x01		// start/stop bus master
+#define BM_CMD_READ	0x08		// direction: device to memory
+#define BM_STATUS	2
+#define BM_ST_ACTIVE	0x01		// transfer in progress
+#define BM_ST_ERR	0x02		// (write 1 to clear)
+#define BM_ST_INTR	0x04		// device raised its interrupt (w1c)
+#define BM_PRDT		4		// physical address of the PRD table
+
+#define PRD_EOT		0x80000000	// last entry of the PRD table
+#define NPRD		4		// a 256-sector read needs at most 3
+
+// Physical region descriptor.  'count' holds the byte count in its low
+// 16 bits (0 means 64KB); a region must not cross a 64KB boundary.
+struct Prd {
+  uint32_t addr;
+  uint32_t count;
+};
+
+static struct Prd prdt[NPRD] __attribute__((aligned(8)));
+static uint16_t bmbase;		// 0 if there is no usable controller
+
+int
+idedma_init(void)
+{
+  uint32_t tag, class;
+
+  if (!(tag = pci_find_class(0x01, 0x01)))      // mass storage, IDE
+    return -1;
+  class = pci_conf_read(tag, 0x08);
+  // The controller must be bus-master capable (prog-if bit 7), and the
+  // primary channel must be in compatibility mode (prog-if bit 0 clear),
+  // i.e. at the legacy ports we send commands to.
+  if (!(class & 0x8000) || (class & 0x0100))
+    return -1;
+  bmbase = pci_conf_read(tag, 0x20) & 0xFFFC;
+  if (bmbase == 0)
+    return -1;
+  // enable I/O space decoding and bus mastering
+  pci_conf_write(tag, 0x04, pci_conf_read(tag, 0x04) | 0x05);
+  return 0;
+}
+
+// Read 'nsect' (1..MAXSECTS) sectors starting at sector 'offset' into
+// physical address 'dst' with one READ DMA command.
+int
+idedma_read(void *dst, uint32_t offset, uint32_t nsect)
+{
+  uint32_t pa, len, n;
+  uint8_t st;
+  int i;
+
+  if (!bmbase)
+    return -1;
+
+  pa = (uint32_t) dst;
+  len = nsect * SECTSIZE;
+  for (i = 0; len > 0; i++) {
+    n = 0x10000 - (pa & 0xFFFF);
+    if (n > len)
+      n = len;
+    prdt[i].addr = pa;
+    prdt[i].count = n & 0xFFFF;
+    pa += n;
+    len -= n;
+  }
+  prdt[i - 1].count |= PRD_EOT;
+
+  outb(bmbase + BM_CMD, 0);
+  outl(bmbase + BM_PRDT, (uint32_t) prdt);
+  outb(bmbase + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+
+  waitdisk();
+  ata_cmd(offset, nsect, ATA_READ_DMA, ATA_READ_DMA_EXT);
+  outb(bmbase + BM_CMD, BM_CMD_READ | BM_CMD_START);
+
+  // Interrupts are off; poll until the controller goes idle or the
+  // drive signals completion (or failure).
+  while (((st = inb(bmbase + BM_STATUS)) & (BM_ST_ACTIVE | BM_ST_INTR))
+         == BM_ST_ACTIVE)
+    /* do nothing */ ;
+  outb(bmbase + BM_CMD, 0);
+
+  // Reading the ATA status also acknowledges the drive's interrupt.
+  if ((st & BM_ST_ERR) || (inb(0x1F7) & 0x21)) {
+    // don't try again; PIO still works
+    bmbase = 0;
+    return -1;
+  }
+  return 0;
+}
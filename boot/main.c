@@ -1,17 +1,30 @@
 #include <inc/x86.h>
-#include <inc/elf.h>
+#include <inc/mmu.h>
+#include <inc/memlayout.h>
+#include <inc/manifest.h>
+#include <inc/hibernate.h>
+#include <inc/lz4.h>
+#include <inc/assert.h>
+
+#include <boot/boot.h>
 
 /**********************************************************************
  * This a dirt simple boot loader, whose sole job is to boot
  * an ELF kernel image from the first IDE hard disk.
  *
  * DISK LAYOUT
- *  * This program(boot.S and main.c) is the bootloader.  It should
- *    be stored in the first sector of the disk.
+ *  * boot.S is the stage 1 bootloader.  It should be stored in the
+ *    first sector of the disk.
+ *
+ *  * Sector MANIFEST_SECT holds the boot manifest (see inc/manifest.h),
+ *    which says where each run of the kernel image goes in memory.
+ *
+ *  * boot2.S and this file are the stage 2 bootloader, stored in the
+ *    BOOT2_NSECT sectors after that (see inc/memlayout.h).  Being out
+ *    of the boot sector, stage 2 is not limited to 510 bytes.
  * 
- *  * The 2nd sector onward holds the kernel image.
- *	
- *  * The kernel image must be in ELF format.
+ *  * Sector KERNSECT onward holds the kernel image, as packed by
+ *    kern/mkimg.c: the ELF kernel's segments, some LZ4-compressed.
  *
  * BOOT UP STEPS	
  *  * when the CPU boots it loads the BIOS into memory and executes it
@@ -23,41 +36,97 @@
  *  * Assuming this boot loader is stored in the first sector of the
  *    hard-drive, this code takes over...
  *
- *  * control starts in boot.S -- which sets up protected mode,
- *    and a stack so C code then run, then calls bootmain()
+ *  * control starts in boot.S -- which loads the manifest and stage 2, sets up
+ *    protected mode, and a stack so C code then run, then jumps
+ *    to boot2.S, which calls bootmain()
  *
- *  * bootmain() in this file takes over, reads in the kernel and jumps to it.
+ *  * bootmain() in this file takes over, reads in the kernel as the
+ *    manifest directs, and jumps to it.  If the kernel left a
+ *    hibernation image (inc/hibernate.h), bootmain() restores that and
+ *    jumps back into the kernel instead.
+ *    It uses AHCI (ahci.c) when there is a SATA controller, bus-master
+ *    DMA (idedma.c) when the IDE controller supports it, and programmed
+ *    I/O otherwise.
  **********************************************************************/
 
-#define SECTSIZE	512
-#define ELFHDR		((struct Elf *) 0x10000)        // scratch space
+#define MF		((struct Manifest *) MANIFEST)
+#define BI		((struct Bootinfo *) BOOTINFO)
+#define HIBHDR		((struct Hibhdr *) HIB_SCRATCH)
+#define HIBRUNS		((struct Hibrun *) (HIB_SCRATCH + SECTSIZE))
 
-void readsect(void *, uint32_t);
 void readseg(uint32_t, uint32_t, uint32_t);
+int readseg_lz4(struct Mfentry *);
+void zeroseg(uint32_t, uint32_t);
+void bootstamp(uint32_t, uint32_t);
+void resume(void);
 
 void
 bootmain(void)
 {
-  struct Proghdr *ph, *eph;
+  struct Mfentry *me, *eme;
+
+  // boot.S fills in the memory map through these fixed addresses
+  static_assert(offsetof(struct Bootinfo, bi_ne820) + BOOTINFO
+                == BOOTINFO_NE820);
+  static_assert(offsetof(struct Bootinfo, bi_e820) + BOOTINFO
+                == BOOTINFO_E820);
+  static_assert(sizeof(struct E820ent) == E820ENT_SIZE);
+  static_assert(offsetof(struct Bootinfo, bi_nstamp) + BOOTINFO
+                == BOOTINFO_NSTAMP);
+  static_assert(offsetof(struct Bootinfo, bi_stamps) + BOOTINFO
+                == BOOTINFO_STAMPS);
+  static_assert(sizeof(struct Bootstamp) == BOOTSTAMP_SIZE);
+  static_assert(sizeof(struct Manifest) <= SECTSIZE);
+
+  BI->bi_magic = BOOTINFO_MAGIC;
+  BI->bi_nzeroed = 0;
+  BI->bi_cmdline[0] = 0;
+  BI->bi_nmods = 0;
+  bootstamp(BT_BOOTMAIN, 0);
 
-  // read 1st page off disk
-  readseg((uint32_t) ELFHDR, SECTSIZE * 8, 0);
+  // Prefer AHCI (q35 and other machines without legacy IDE), then
+  // bus-master IDE DMA, then programmed I/O.
+  if (ahci_init() < 0)
+    idedma_init();
 
-  // is this a valid ELF?
-  if (ELFHDR->e_magic != ELF_MAGIC)
+  // boot.S loaded the manifest along with us; is it valid?
+  if (MF->mf_magic != MANIFEST_MAGIC || MF->mf_nent > MF_NENT)
     goto bad;
 
-  // load each program segment (ignores ph flags)
-  ph = (struct Proghdr *)((uint8_t *) ELFHDR + ELFHDR->e_phoff);
-  eph = ph + ELFHDR->e_phnum;
-  for (; ph < eph; ph++)
-    // p_pa is the load address of this segment (as well
-    // as the physical address)
-    readseg(ph->p_pa, ph->p_memsz, ph->p_offset);
+  // only returns if there is no hibernation image
+  resume();
 
-  // call the entry point from the ELF header
+  // Read each run.  The manifest lists them in disk order, so this
+  // is one forward sweep over the kernel image.
+  eme = MF->mf_ents + MF->mf_nent;
+  for (me = MF->mf_ents; me < eme; me++) {
+    if (me->me_nsect == 0)
+      continue;
+    if (!(me->me_flags & MF_LZ4))
+      readseg(me->me_pa, me->me_sect, me->me_nsect);
+    else if (readseg_lz4(me) < 0)
+      goto bad;
+    bootstamp(BT_SEGMENT, me - MF->mf_ents);
+  }
+
+  // Then zero the rest (the BSS), which has nothing on disk.  This
+  // comes second because readseg() works in whole sectors and may
+  // spill past me_filesz.  Tell the kernel what is already clear.
+  for (me = MF->mf_ents; me < eme; me++) {
+    if (me->me_memsz <= me->me_filesz)
+      continue;
+    zeroseg(me->me_pa + me->me_filesz, me->me_memsz - me->me_filesz);
+    if (BI->bi_nzeroed < BI_NZEROED) {
+      BI->bi_zeroed[BI->bi_nzeroed].start = me->me_pa + me->me_filesz;
+      BI->bi_zeroed[BI->bi_nzeroed].end = me->me_pa + me->me_memsz;
+      BI->bi_nzeroed++;
+    }
+  }
+  bootstamp(BT_BSS, 0);
+
+  // call the kernel's entry point
   // note: does not return!
-  ((void (*)(void))(ELFHDR->e_entry)) ();
+  ((void (*)(void))(MF->mf_entry)) ();
 
  bad:
   outw(0x8A00, 0x8A00);
@@ -66,36 +135,118 @@ bootmain(void)
     /* do nothing */ ;
 }
 
-// Read 'count' bytes at 'offset' from kernel into physical address 'pa'
-// Might copy more than asked
-// Offset: offset in the kernel image (starts from the 1st sector of disk
+// Append a point to the boot timeline.
 void
-readseg(uint32_t pa, uint32_t count, uint32_t offset)
+bootstamp(uint32_t id, uint32_t arg)
 {
-  uint32_t end_pa;
+  struct Bootstamp *bs;
 
-  end_pa = pa + count;
+  if (BI->bi_nstamp >= BI_NSTAMP)
+    return;
+  bs = &BI->bi_stamps[BI->bi_nstamp++];
+  bs->bs_tsc = read_tsc();
+  bs->bs_id = id;
+  bs->bs_arg = arg;
+}
+
+// If the kernel left a hibernation image, restore it and jump back into
+// the kernel.  The image must come from this very kernel image.
+void
+resume(void)
+{
+  struct Hibrun *hr, *ehr;
+  uint32_t sect, n;
+
+  if (MF->mf_hibnsect == 0)
+    return;
+  sect = MF->mf_hibsect;
+  readseg((uint32_t) HIBHDR, sect, 1);
+  if (HIBHDR->hh_magic != HIBERNATE_MAGIC
+      || HIBHDR->hh_kernsum != manifest_sum(MF)
+      || HIBHDR->hh_nrun > HIB_MAXRUN
+      || HIBHDR->hh_nsect > MF->mf_hibnsect)
+    return;
+  readseg((uint32_t) HIBRUNS, sect + 1, HIB_TABSECTS(HIBHDR->hh_nrun));
+
+  // The page data follows the run table, in run order: again one
+  // forward sweep.
+  sect += 1 + HIB_TABSECTS(HIBHDR->hh_nrun);
+  ehr = HIBRUNS + HIBHDR->hh_nrun;
+  for (hr = HIBRUNS; hr < ehr; hr++) {
+    n = hr->hr_npages * (PGSIZE / SECTSIZE);
+    if (hr->hr_flags & HR_ZERO)
+      zeroseg(hr->hr_pa, hr->hr_npages * PGSIZE);
+    else {
+      readseg(hr->hr_pa, sect, n);
+      sect += n;
+    }
+  }
+  bootstamp(BT_RESUME, 0);
+
+  // note: does not return!
+  ((void (*)(void)) HIBHDR->hh_resume) ();
+}
 
-  // round down to sector boundary
-  pa &= ~(SECTSIZE - 1);
+// Read 'nsect' sectors starting at sector 'sect' of the kernel image
+// (sector KERNSECT of the disk) into physical address 'pa'.
+void
+readseg(uint32_t pa, uint32_t sect, uint32_t nsect)
+{
+  uint32_t offset, end;
+  int n;
 
-  // translate from bytes to sectors, and kernel starts at sector 1
-  offset = (offset / SECTSIZE) + 1;
+  offset = sect + KERNSECT;
+  end = offset + nsect;
 
-  // If this is too slow, we could read lots of sectors at a time.
-  // We'd write more to memory than asked, but it doesn't matter --
-  // we load in increasing order.
-  while (pa < end_pa) {
+  // Read as many sectors per command as the controller allows.
+  while (offset < end) {
+    n = end - offset;
     // Since we haven't enabled paging yet and we're using
     // an identity segment mapping (see boot.S), we can
     // use physical addresses directly.  This won't be the
     // case once JOS enables the MMU.
-    readsect((uint8_t *) pa, offset);
-    pa += SECTSIZE;
-    offset++;
+    if ((n = ahci_read((uint8_t *) pa, offset, n)) < 0) {
+      n = MIN(end - offset, MAXSECTS);
+      if (idedma_read((uint8_t *) pa, offset, n) < 0)
+        readsects((uint8_t *) pa, offset, n);
+    }
+    pa += n * SECTSIZE;
+    offset += n;
   }
 }
 
+// Load a run stored as a 4-byte compressed length followed by an
+// LZ4 block.  The block is staged just past the run's memory image,
+// then decompressed into place.
+int
+readseg_lz4(struct Mfentry *me)
+{
+  uint32_t *stage;
+
+  stage = (uint32_t *) ROUNDUP(me->me_pa + me->me_memsz, SECTSIZE);
+  readseg((uint32_t) stage, me->me_sect, me->me_nsect);
+  if (stage[0] + 4 > me->me_nsect * SECTSIZE
+      || lz4_decompress(stage + 1, stage[0], (void *) me->me_pa,
+                        me->me_filesz) != me->me_filesz)
+    return -1;
+  return 0;
+}
+
+// Zero 'len' bytes at physical address 'pa', a dword at a time
+// except for the unaligned ends.
+void
+zeroseg(uint32_t pa, uint32_t len)
+{
+  uint32_t n;
+
+  n = MIN((-pa) & 3, len);
+  stosb((void *) pa, 0, n);
+  pa += n;
+  len -= n;
+  stosl((void *) pa, 0, len / 4);
+  stosb((void *) (pa + (len & ~3)), 0, len & 3);
+}
+
 void
 waitdisk(void)
 {
@@ -104,22 +255,51 @@ waitdisk(void)
     /* do nothing */ ;
 }
 
+// Send a read command for 'nsect' (1..MAXSECTS) sectors starting at
+// sector 'offset' to the primary master: 'cmd' if the whole range is
+// reachable with 28-bit LBA, otherwise its LBA48 form 'cmd48'.
 void
-readsect(void *dst, uint32_t offset)
+ata_cmd(uint32_t offset, uint32_t nsect, uint8_t cmd, uint8_t cmd48)
 {
-  // wait for disk to be ready
-  waitdisk();
+  if (offset + nsect <= ATA_LBA28_MAX) {
+    outb(0x1F2, nsect);         // count; 0 means 256
+    outb(0x1F3, offset);
+    outb(0x1F4, offset >> 8);
+    outb(0x1F5, offset >> 16);
+    outb(0x1F6, (offset >> 24) | 0xE0);
+    outb(0x1F7, cmd);
+    return;
+  }
 
-  outb(0x1F2, 1);               // count = 1
+  // LBA48: each register takes its high-order byte, then its
+  // low-order byte.  'offset' only has 32 bits, so LBA bits 32-47
+  // are zero.
+  outb(0x1F2, nsect >> 8);
+  outb(0x1F2, nsect);
+  outb(0x1F3, offset >> 24);
   outb(0x1F3, offset);
+  outb(0x1F4, 0);
   outb(0x1F4, offset >> 8);
+  outb(0x1F5, 0);
   outb(0x1F5, offset >> 16);
-  outb(0x1F6, (offset >> 24) | 0xE0);
-  outb(0x1F7, 0x20);            // cmd 0x20 - read sectors
+  outb(0x1F6, 0x40);            // LBA, master
+  outb(0x1F7, cmd48);
+}
 
+// Read 'nsect' (1..MAXSECTS) consecutive sectors starting at sector
+// 'offset' into 'dst' with a single READ SECTORS command.
+void
+readsects(void *dst, uint32_t offset, uint32_t nsect)
+{
   // wait for disk to be ready
   waitdisk();
 
-  // read a sector
-  insl(0x1F0, dst, SECTSIZE / 4);
+  ata_cmd(offset, nsect, ATA_READ, ATA_READ_EXT);
+
+  // the drive raises DRQ once per sector
+  while (nsect-- > 0) {
+    waitdisk();
+    insl(0x1F0, dst, SECTSIZE / 4);
+    dst = (uint8_t *) dst + SECTSIZE;
+  }
 }
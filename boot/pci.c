@@ -0,0 +1,52 @@
+#include <inc/x86.h>
+
+#include <boot/boot.h>
+
+// Minimal PCI configuration space access (mechanism #1) for the boot
+// loader.  We only look at bus 0, which is where QEMU and most simple
+// PCs put their storage controllers.
+
+#define PCI_CONF_ADDR	0xCF8
+#define PCI_CONF_DATA	0xCFC
+
+#define PCI_ID_REG	0x00
+#define PCI_CLASS_REG	0x08
+#define PCI_HDR_REG	0x0C
+
+uint32_t
+pci_conf_read(uint32_t tag, uint32_t off)
+{
+  outl(PCI_CONF_ADDR, tag | (off & 0xFC));
+  return inl(PCI_CONF_DATA);
+}
+
+void
+pci_conf_write(uint32_t tag, uint32_t off, uint32_t v)
+{
+  outl(PCI_CONF_ADDR, tag | (off & 0xFC));
+  outl(PCI_CONF_DATA, v);
+}
+
+// Return the tag of the first function on bus 0 with the given class
+// and subclass, or 0 if there is none.
+uint32_t
+pci_find_class(uint32_t class, uint32_t subclass)
+{
+  uint32_t dev, func, nfunc, tag, v;
+
+  for (dev = 0; dev < 32; dev++) {
+    nfunc = 1;
+    for (func = 0; func < nfunc; func++) {
+      tag = 0x80000000 | (dev << 11) | (func << 8);
+      if ((pci_conf_read(tag, PCI_ID_REG) & 0xFFFF) == 0xFFFF)
+        continue;
+      // multi-function device?
+      if (func == 0 && (pci_conf_read(tag, PCI_HDR_REG) & 0x00800000))
+        nfunc = 8;
+      v = pci_conf_read(tag, PCI_CLASS_REG);
+      if ((v >> 24) == class && ((v >> 16) & 0xFF) == subclass)
+        return tag;
+    }
+  }
+  return 0;
+}
@@ -1,22 +1,34 @@
 #!/usr/bin/perl
+#
+# sign.pl file		- pad the stage 1 boot block and add the 0x55AA
+#			  boot signature
+# sign.pl file nsect	- pad the stage 2 loader to exactly nsect sectors
 
 open(BB, $ARGV[0]) || die "open $ARGV[0]: $!";
 
 binmode BB;
 my $buf;
-read(BB, $buf, 1000);
+read(BB, $buf, 1 << 20);
 $n = length($buf);
 
-if($n > 510){
-	print STDERR "boot block too large: $n bytes (max 510)\n";
-	exit 1;
+if(@ARGV > 1){
+	$max = 512 * $ARGV[1];
+	if($n > $max){
+		print STDERR "stage 2 loader too large: $n bytes (max $max)\n";
+		exit 1;
+	}
+	print STDERR "stage 2 loader is $n bytes (max $max)\n";
+	$buf .= "\0" x ($max-$n);
+} else {
+	if($n > 510){
+		print STDERR "boot block too large: $n bytes (max 510)\n";
+		exit 1;
+	}
+	print STDERR "boot block is $n bytes (max 510)\n";
+	$buf .= "\0" x (510-$n);
+	$buf .= "\x55\xAA";
 }
 
-print STDERR "boot block is $n bytes (max 510)\n";
-
-$buf .= "\0" x (510-$n);
-$buf .= "\x55\xAA";
-
 open(BB, ">$ARGV[0]") || die "open >$ARGV[0]: $!";
 binmode BB;
 print BB $buf;
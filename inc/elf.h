@@ -32,6 +32,37 @@ struct Proghdr {
 	uint32_t p_align;
 };
 
+// The x86-64 kernel is a 64-bit ELF file (e_elf[0] == ELF_CLASS_64),
+// whose headers have wider fields, in a different order.
+struct Elf64 {
+	uint32_t e_magic;	// must equal ELF_MAGIC
+	uint8_t e_elf[12];
+	uint16_t e_type;
+	uint16_t e_machine;
+	uint32_t e_version;
+	uint64_t e_entry;
+	uint64_t e_phoff;
+	uint64_t e_shoff;
+	uint32_t e_flags;
+	uint16_t e_ehsize;
+	uint16_t e_phentsize;
+	uint16_t e_phnum;
+	uint16_t e_shentsize;
+	uint16_t e_shnum;
+	uint16_t e_shstrndx;
+};
+
+struct Proghdr64 {
+	uint32_t p_type;
+	uint32_t p_flags;
+	uint64_t p_offset;
+	uint64_t p_va;
+	uint64_t p_pa;
+	uint64_t p_filesz;
+	uint64_t p_memsz;
+	uint64_t p_align;
+};
+
 struct Secthdr {
 	uint32_t sh_name;
 	uint32_t sh_type;
@@ -45,6 +76,10 @@ struct Secthdr {
 	uint32_t sh_entsize;
 };
 
+// Values for Elf::e_elf[0] (the file class)
+#define ELF_CLASS_32		1
+#define ELF_CLASS_64		2
+
 // Values for Proghdr::p_type
 #define ELF_PROG_LOAD		1
 
@@ -52,6 +87,9 @@ struct Secthdr {
 #define ELF_PROG_FLAG_EXEC	1
 #define ELF_PROG_FLAG_WRITE	2
 #define ELF_PROG_FLAG_READ	4
+// (OS-specific) file contents are a 4-byte length and an LZ4 block;
+// set by kern/mkimg.c for the boot loader
+#define ELF_PROG_FLAG_LZ4	0x00100000
 
 // Values for Secthdr::sh_type
 #define ELF_SHT_NULL		0
@@ -0,0 +1,44 @@
+#ifndef JOS_INC_HIBERNATE_H
+#define JOS_INC_HIBERNATE_H
+
+// The hibernation image, written by the kernel's 'hibernate' command
+// (kern/hibernate.c) into the disk area the boot manifest reserves for
+// it, and restored by the boot loader in place of loading the kernel.
+//
+// Layout, in sectors from the start of the area:
+//	0			struct Hibhdr
+//	1			hh_nrun struct Hibrun entries
+//	1 + table sectors	the page data of each run without HR_ZERO,
+//				in run order
+
+#define HIBERNATE_MAGIC	0x4E42484AU	/* "JHBN" in little endian */
+#define HIB_MAXRUN	1024
+
+// hr_flags
+#define HR_ZERO		0x1		// all-zero pages; nothing on disk
+
+struct Hibrun {
+	uint32_t hr_pa;		// first page
+	uint32_t hr_npages;
+	uint32_t hr_flags;
+};
+
+struct Hibhdr {
+	uint32_t hh_magic;	// must equal HIBERNATE_MAGIC
+	uint32_t hh_kernsum;	// manifest checksum of the kernel that wrote it
+	uint32_t hh_resume;	// physical address to jump to
+	uint32_t hh_nrun;	// entries in the run table
+	uint32_t hh_nsect;	// sectors used, including this one
+};
+
+// Sectors the run table for 'nrun' runs takes.
+#define HIB_TABSECTS(nrun) \
+	(((nrun) * sizeof(struct Hibrun) + 511) / 512)
+
+// Where the boot loader reads the header and run table while resuming.
+// Like the loader itself, the kernel never hands these pages out, so
+// no run covers them.
+#define HIB_SCRATCH	0x10000
+#define HIB_SCRATCH_END	(HIB_SCRATCH + 512 + HIB_TABSECTS(HIB_MAXRUN) * 512)
+
+#endif /* !JOS_INC_HIBERNATE_H */
@@ -0,0 +1,12 @@
+#ifndef JOS_INC_LZ4_H
+#define JOS_INC_LZ4_H
+
+#include <inc/types.h>
+
+// lib/lz4.c
+// Decompress the raw LZ4 block of 'srclen' bytes at 'src' into at most
+// 'dstlen' bytes at 'dst'.  Returns the number of bytes produced, or -1
+// if the block is malformed or would overflow 'dst'.
+int	lz4_decompress(const void *src, size_t srclen, void *dst, size_t dstlen);
+
+#endif /* !JOS_INC_LZ4_H */
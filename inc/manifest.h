@@ -0,0 +1,47 @@
+#ifndef JOS_INC_MANIFEST_H
+#define JOS_INC_MANIFEST_H
+
+// The boot manifest, written by kern/mkimg.c into disk sector
+// MANIFEST_SECT (see inc/memlayout.h).  It tells the stage 2 loader
+// which runs of disk sectors go where in physical memory, so the loader
+// needs no ELF parsing: it reads the runs in order, which is disk order,
+// in a single forward sweep.  The manifest also locates the disk area
+// reserved for a hibernation image (inc/hibernate.h).
+
+#define MANIFEST_MAGIC	0x464E4D4AU	/* "JMNF" in little endian */
+#define MF_NENT		20		// entries that fit in one sector
+
+// me_flags
+#define MF_LZ4		0x1		// run is a 4-byte length + LZ4 block
+
+struct Mfentry {
+	uint32_t me_sect;	// first sector, relative to KERNSECT
+	uint32_t me_nsect;	// sectors on disk
+	uint32_t me_pa;		// physical load address
+	uint32_t me_filesz;	// bytes at me_pa that come from disk
+	uint32_t me_memsz;	// me_filesz plus bytes to zero-fill
+	uint32_t me_flags;
+};
+
+struct Manifest {
+	uint32_t mf_magic;	// must equal MANIFEST_MAGIC
+	uint32_t mf_entry;	// kernel entry point
+	uint32_t mf_nent;	// entries used, sorted by me_sect
+	uint32_t mf_hibsect;	// hibernation area, relative to KERNSECT
+	uint32_t mf_hibnsect;	// its size in sectors; 0 if none
+	struct Mfentry mf_ents[MF_NENT];
+};
+
+// A checksum of the manifest, which tells one kernel image from another.
+static __inline uint32_t
+manifest_sum(const struct Manifest *mf)
+{
+	const uint32_t *p = (const uint32_t *) mf;
+	uint32_t i, sum = 0;
+
+	for (i = 0; i < sizeof(*mf) / 4; i++)
+		sum = (sum << 1 | sum >> 31) + p[i];
+	return sum;
+}
+
+#endif /* !JOS_INC_MANIFEST_H */
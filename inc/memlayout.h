@@ -24,6 +24,10 @@
  *                                                    kernel/user
  *
  *    4 Gig -------->  +------------------------------+
+ *                     |      Highmem kmap slots      | RW/--  PTSIZE
+ *    KMAPBASE ----->  +------------------------------+ 0xffc00000
+ *                     |   vmalloc() address space    | RW/--  16*PTSIZE
+ *    VMALLOCBASE -->  +------------------------------+ 0xfbc00000
  *                     |                              | RW/--
  *                     ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  *                     :              .               :
@@ -78,8 +82,28 @@
  */
 
 
-// All physical memory mapped at this address
+// All physical memory mapped at this address.  The x86-64 kernel is
+// compiled for the top 2GB of the address space (-mcmodel=kernel), so
+// its KERNBASE is there; the rest of the map above describes i386.
+#ifdef __x86_64__
+#define	KERNBASE	0xFFFFFFFF80000000
+#else
 #define	KERNBASE	0xF0000000
+#endif
+
+// Physical memory is mapped at KERNBASE only as far as VMALLOCBASE
+// (188MB on i386).  Pages above that ("highmem") are reached by mapping
+// them one at a time into one of KMAP_NSLOTS page slots starting at
+// KMAPBASE; see kmap() in kern/pmap.c.  In between, vmalloc() maps
+// virtually contiguous kernel memory.
+#ifdef __x86_64__
+#define VMALLOCBASE	0xFFFFFFFFE0000000
+#define KMAPBASE	0xFFFFFFFFFFE00000
+#else
+#define VMALLOCBASE	0xFBC00000
+#define KMAPBASE	0xFFC00000
+#endif
+#define KMAP_NSLOTS	32
 
 // At IOPHYSMEM (640K) there is a 384K hole for I/O.  From the kernel,
 // IOPHYSMEM can be addressed at KERNBASE + IOPHYSMEM.  The hole ends
@@ -87,6 +111,63 @@
 #define IOPHYSMEM	0x0A0000
 #define EXTPHYSMEM	0x100000
 
+// The boot loader leaves a struct Bootinfo for the kernel at this physical
+// address, in free conventional memory well below the boot sector.
+#define BOOTINFO	0x1000
+#define BOOTINFO_MAGIC	0x42534F4A	// "JOSB"
+
+// boot.S stores the BIOS E820 memory map into the Bootinfo block from
+// real mode, so it needs these two fields at fixed addresses.
+#define BOOTINFO_NE820	(BOOTINFO + 4)	// &bi_ne820
+#define BOOTINFO_E820	(BOOTINFO + 8)	// &bi_e820[0]
+#define BI_NE820	32		// max memory map entries kept
+#define E820ENT_SIZE	20		// sizeof(struct E820ent)
+
+// Boot timeline: each boot stage appends a TSC stamp, from boot.S
+// through the kernel's first monitor prompt.  Assembly code appends
+// through these fixed addresses too.
+#define BOOTINFO_NSTAMP	(BOOTINFO_E820 + BI_NE820 * E820ENT_SIZE)
+#define BOOTINFO_STAMPS	(BOOTINFO_NSTAMP + 8)	// &bi_stamps[0]
+#define BI_NSTAMP	24		// max stamps kept
+#define BOOTSTAMP_SIZE	16		// sizeof(struct Bootstamp)
+
+// Boot timeline points
+#define BT_START	0		// boot.S start
+#define BT_BOOTMAIN	1		// stage 2 bootmain()
+#define BT_SEGMENT	2		// loader read a segment (arg: which)
+#define BT_BSS		3		// loader zeroed the BSS
+#define BT_ENTRY	4		// kern/entry.S entry
+#define BT_INIT		5		// i386_init()
+#define BT_CONS		6		// console initialized
+#define BT_MONITOR	7		// first kernel monitor prompt
+#define BT_KEXEC	8		// previous kernel's kexec command
+#define BT_RESUME	9		// loader restored a hibernation image
+
+// E820 memory range types
+#define E820_RAM	1		// usable RAM
+#define E820_RESERVED	2
+#define E820_ACPI	3		// ACPI tables; RAM once they are read
+#define E820_NVS	4		// ACPI non-volatile storage
+#define E820_BAD	5		// defective RAM
+
+// The boot sector loads the boot manifest (inc/manifest.h) from disk
+// sector MANIFEST_SECT to physical address MANIFEST, right after
+// itself, and with the same read the stage 2 boot loader from the
+// BOOT2_NSECT sectors after that to physical address BOOT2.  The kernel
+// image follows on disk, starting at sector KERNSECT.
+#define MANIFEST	0x7E00
+#define MANIFEST_SECT	1
+#define BOOT2		0x8000
+#define BOOT2_NSECT	32
+#define KERNSECT	(MANIFEST_SECT + 1 + BOOT2_NSECT)
+
+// The boot loader's memory: its stack below the boot sector (and the
+// kexec trampoline under that) up to the end of stage 2.  A loader run
+// again to resume a hibernation image, or a kexec, reuses it, so the
+// kernel never hands these pages out.
+#define BOOTLOADER	0x7000
+#define BOOTLOADER_END	(BOOT2 + BOOT2_NSECT * 512)
+
 // Virtual page table.  Entry PDX[VPT] in the PD contains a pointer to
 // the page directory itself, thereby turning the PD into a page table,
 // which maps all the PTEs containing the page mappings for the entire
@@ -150,6 +231,8 @@
  */
 typedef uint32_t pte_t;
 typedef uint32_t pde_t;
+typedef uint64_t pae_pte_t;	// entries under PAE paging
+typedef uint64_t pae_pde_t;
 
 extern volatile pte_t vpt[];     // VA of "virtual page table"
 extern volatile pde_t vpd[];     // VA of current page directory
@@ -177,6 +260,63 @@ struct Page {
 	// boot_alloc do not have valid reference count fields.
 
 	uint16_t pp_ref;
+
+	// For the first page of a free block in the buddy allocator,
+	// the block's order (it spans 1 << pp_order pages); for a free
+	// page held in a magazine or the zero pool, PAGE_MAGAZINE or
+	// PAGE_ZEROPOOL; for a page page_init() never freed (not RAM, or
+	// reserved), PAGE_RESERVED; otherwise PAGE_NOTFREE.
+	uint8_t pp_order;
+};
+
+/*
+ * Boot loader to kernel handoff block, at physical address BOOTINFO.
+ * Only valid if bi_magic == BOOTINFO_MAGIC; a kernel started some other
+ * way finds garbage here.  The loader is 32-bit code even for the
+ * x86-64 kernel, so every field has a fixed size.
+ */
+#define BI_NZEROED	4
+#define BI_NMODS	4
+#define BI_CMDLINE	128
+
+// One range of the BIOS memory map, as returned by int 0x15, %eax=0xE820
+struct E820ent {
+	uint64_t addr;
+	uint64_t len;
+	uint32_t type;			// E820_*
+} __attribute__((packed));
+
+// One point of the boot timeline
+struct Bootstamp {
+	uint64_t bs_tsc;
+	uint32_t bs_id;			// BT_*
+	uint32_t bs_arg;
+};
+
+struct Bootinfo {
+	uint32_t bi_magic;
+	uint32_t bi_ne820;		// valid entries in bi_e820
+	struct E820ent bi_e820[BI_NE820];	// filled in by boot.S
+
+	uint32_t bi_nstamp;		// valid entries in bi_stamps
+	uint32_t bi_nzeroed;		// valid entries in bi_zeroed
+	struct Bootstamp bi_stamps[BI_NSTAMP];
+
+	// Physical ranges [start, end) the loader zero-filled (the BSS
+	// part of each segment), so the kernel need not clear them again.
+	struct {
+		uint32_t start;
+		uint32_t end;
+	} bi_zeroed[BI_NZEROED];
+
+	// Kernel command line and modules (from a Multiboot loader)
+	char bi_cmdline[BI_CMDLINE];
+	uint32_t bi_nmods;		// valid entries in bi_mods
+	struct {
+		uint32_t start;		// physical [start, end)
+		uint32_t end;
+		char name[32];
+	} bi_mods[BI_NMODS];
 };
 
 #endif /* !__ASSEMBLER__ */
@@ -56,6 +56,37 @@
 #define PTXSHIFT	12		// offset of PTX in a linear address
 #define PDXSHIFT	22		// offset of PDX in a linear address
 
+// PAE paging (CR4_PAE) splits a linear address three ways instead,
+// with 64-bit entries, 512 to a page directory or page table:
+//
+// +2-+-------9------+-------9------+---------12----------+
+// |  | Page Dir     |   Page Table | Offset within Page  |
+// |  |   Index      |     Index    |                     |
+// +--+--------------+--------------+---------------------+
+//  \ \- PAE_PDX(la)/ \PAE_PTX(la)-/
+//   \- PAE_PDPX(la): one of the 4 page directory pointer table entries
+//
+// A page directory entry with PTE_PS maps a 2MB large page.
+#define PAE_PDPX(la)	((((uintptr_t) (la)) >> PAE_PDPSHIFT) & 0x3)
+#define PAE_PDX(la)	((((uintptr_t) (la)) >> PAE_PDXSHIFT) & 0x1FF)
+#define PAE_PTX(la)	((((uintptr_t) (la)) >> PTXSHIFT) & 0x1FF)
+
+#define PAE_NPDPENTRIES	4		// entries in the pointer table
+#define PAE_NPDENTRIES	512		// page directory entries per page directory
+#define PAE_NPTENTRIES	512		// page table entries per page table
+
+#define PAE_PTSIZE	(PGSIZE*PAE_NPTENTRIES) // bytes mapped by a PAE PDE
+#define PAE_PDXSHIFT	21		// offset of PAE_PDX in a linear address
+#define PAE_PDPSHIFT	30		// offset of PAE_PDPX in a linear address
+
+// Long mode (x86-64) paging puts a page map level 4 (PML4) table above
+// the PAE levels, and widens the page directory pointer table to 512
+// entries.  All four levels use the PAE entry format.
+#define PML4X(la)	((((uintptr_t) (la)) >> PML4SHIFT) & 0x1FF)
+#define PDPX64(la)	((((uintptr_t) (la)) >> PAE_PDPSHIFT) & 0x1FF)
+
+#define PML4SHIFT	39		// offset of PML4X in a linear address
+
 // Page table/directory entry flags.
 #define PTE_P		0x001	// Present
 #define PTE_W		0x002	// Writeable
@@ -66,6 +97,7 @@
 #define PTE_D		0x040	// Dirty
 #define PTE_PS		0x080	// Page Size
 #define PTE_G		0x100	// Global
+#define PTE_NX		0x8000000000000000ULL	// No-execute (PAE only)
 
 // The PTE_AVAIL bits aren't used by the kernel or interpreted by the
 // hardware, so user processes are allowed to set them arbitrarily.
@@ -91,13 +123,28 @@
 #define CR0_PG		0x80000000	// Paging
 
 #define CR4_PCE		0x00000100	// Performance counter enable
+#define CR4_PGE		0x00000080	// Page Global Enable
 #define CR4_MCE		0x00000040	// Machine Check Enable
+#define CR4_PAE		0x00000020	// Physical Address Extension
 #define CR4_PSE		0x00000010	// Page Size Extensions
 #define CR4_DE		0x00000008	// Debugging Extensions
 #define CR4_TSD		0x00000004	// Time Stamp Disable
 #define CR4_PVI		0x00000002	// Protected-Mode Virtual Interrupts
 #define CR4_VME		0x00000001	// V86 Mode Extensions
 
+// CPUID function 1 feature flags in %edx
+#define CPUID_PSE	0x00000008	// Page Size Extensions
+#define CPUID_PAE	0x00000040	// Physical Address Extension
+#define CPUID_PGE	0x00002000	// Page Global Enable
+// CPUID function 0x80000001 feature flags in %edx
+#define CPUID_NX	0x00100000	// No-execute pages
+#define CPUID_LM	0x20000000	// Long mode (x86-64)
+
+// Extended Feature Enable Register
+#define MSR_EFER	0xC0000080
+#define EFER_LME	0x00000100	// Long mode enable
+#define EFER_NXE	0x00000800	// Enable PTE_NX
+
 // Eflags register
 #define FL_CF		0x00000001	// Carry Flag
 #define FL_PF		0x00000004	// Parity Flag
@@ -148,6 +195,11 @@
 	.word (((lim) >> 12) & 0xffff), ((base) & 0xffff);	\
 	.byte (((base) >> 16) & 0xff), (0x90 | (type)),		\
 		(0xC0 | (((lim) >> 28) & 0xf)), (((base) >> 24) & 0xff)
+// A long mode code segment: base and limit are ignored, and the L bit
+// (0x20) takes the place of the D bit.
+#define SEG64(type)						\
+	.word 0, 0;						\
+	.byte 0, (0x90 | (type)), 0x20, 0
 
 #else	// not __ASSEMBLER__
 
@@ -0,0 +1,57 @@
+#ifndef JOS_INC_MULTIBOOT_H
+#define JOS_INC_MULTIBOOT_H
+
+// Multiboot specification, version 0.6.96: just what JOS uses to be
+// started directly by a Multiboot loader (e.g. 'qemu -kernel').
+
+// In the kernel's Multiboot header
+#define MULTIBOOT_HEADER_MAGIC		0x1BADB002
+#define MULTIBOOT_PAGE_ALIGN		0x00000001	// align modules to pages
+#define MULTIBOOT_MEMORY_INFO		0x00000002	// want mem_* and mmap_*
+
+// In %eax when the loader jumps to the kernel; %ebx holds the
+// physical address of a struct Mbinfo.
+#define MULTIBOOT_BOOTLOADER_MAGIC	0x2BADB002
+
+// Mbinfo::mb_flags bits saying which fields are valid
+#define MBI_MEMORY	0x00000001	// mb_mem_lower, mb_mem_upper
+#define MBI_CMDLINE	0x00000004	// mb_cmdline
+#define MBI_MODS	0x00000008	// mb_mods_count, mb_mods_addr
+#define MBI_MMAP	0x00000040	// mb_mmap_length, mb_mmap_addr
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+
+struct Mbinfo {
+	uint32_t mb_flags;
+	uint32_t mb_mem_lower;		// KB of memory at 0
+	uint32_t mb_mem_upper;		// KB of memory at 1MB
+	uint32_t mb_boot_device;
+	uint32_t mb_cmdline;		// physical address of a C string
+	uint32_t mb_mods_count;
+	uint32_t mb_mods_addr;		// physical address of struct Mbmod[]
+	uint32_t mb_syms[4];
+	uint32_t mb_mmap_length;	// bytes of struct Mbmmap records
+	uint32_t mb_mmap_addr;
+};
+
+struct Mbmod {
+	uint32_t mod_start;		// physical [mod_start, mod_end)
+	uint32_t mod_end;
+	uint32_t mod_string;		// physical address of a C string
+	uint32_t mod_reserved;
+};
+
+// Memory map record.  mm_size does not count itself, so the next record
+// starts mm_size + 4 bytes after this one.  mm_type uses E820_* values.
+struct Mbmmap {
+	uint32_t mm_size;
+	uint64_t mm_addr;
+	uint64_t mm_len;
+	uint32_t mm_type;
+} __attribute__((packed));
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_MULTIBOOT_H */
@@ -18,22 +18,29 @@ typedef unsigned int uint32_t;
 typedef long long int64_t;
 typedef unsigned long long uint64_t;
 
-// Pointers and addresses are 32 bits long.
+// Pointers and addresses are 32 bits long, or 64 bits in the x86-64
+// build (make ARCH=x86_64).
 // We use pointer types to represent virtual addresses,
 // uintptr_t to represent the numerical values of virtual addresses,
 // and physaddr_t to represent physical addresses.
+#ifdef __x86_64__
+typedef long intptr_t;
+typedef unsigned long uintptr_t;
+typedef uint64_t physaddr_t;
+#else
 typedef int32_t intptr_t;
 typedef uint32_t uintptr_t;
 typedef uint32_t physaddr_t;
+#endif
 
 // Page numbers are 32 bits long.
 typedef uint32_t ppn_t;
 
 // size_t is used for memory object sizes.
-typedef uint32_t size_t;
+typedef uintptr_t size_t;
 // ssize_t is a signed version of ssize_t, used in case there might be an
 // error return.
-typedef int32_t ssize_t;
+typedef intptr_t ssize_t;
 
 // off_t is used for file offsets and lengths.
 typedef int32_t off_t;
@@ -56,14 +63,14 @@ typedef int32_t off_t;
 // Round down to the nearest multiple of n
 #define ROUNDDOWN(a, n)						\
 ({								\
-	uint32_t __a = (uint32_t) (a);				\
+	uintptr_t __a = (uintptr_t) (a);			\
 	(typeof(a)) (__a - __a % (n));				\
 })
 // Round up to the nearest multiple of n
 #define ROUNDUP(a, n)						\
 ({								\
-	uint32_t __n = (uint32_t) (n);				\
-	(typeof(a)) (ROUNDDOWN((uint32_t) (a) + __n - 1, __n));	\
+	uintptr_t __n = (uintptr_t) (n);			\
+	(typeof(a)) (ROUNDDOWN((uintptr_t) (a) + __n - 1, __n));	\
 })
 
 // Return the offset of 'member' relative to the beginning of a struct type
@@ -2,6 +2,7 @@
 #define JOS_INC_X86_H
 
 #include <inc/types.h>
+#include <inc/mmu.h>
 
 static __inline void breakpoint(void) __attribute__((always_inline));
 static __inline uint8_t inb(int port) __attribute__((always_inline));
@@ -16,22 +17,27 @@ static __inline void outw(int port, uint16_t data) __attribute__((always_inline)
 static __inline void outsw(int port, const void *addr, int cnt) __attribute__((always_inline));
 static __inline void outsl(int port, const void *addr, int cnt) __attribute__((always_inline));
 static __inline void outl(int port, uint32_t data) __attribute__((always_inline));
+static __inline void stosb(void *addr, int data, int cnt) __attribute__((always_inline));
+static __inline void stosl(void *addr, int data, int cnt) __attribute__((always_inline));
 static __inline void invlpg(void *addr) __attribute__((always_inline));
 static __inline void lidt(void *p) __attribute__((always_inline));
 static __inline void lldt(uint16_t sel) __attribute__((always_inline));
 static __inline void ltr(uint16_t sel) __attribute__((always_inline));
-static __inline void lcr0(uint32_t val) __attribute__((always_inline));
-static __inline uint32_t rcr0(void) __attribute__((always_inline));
-static __inline uint32_t rcr2(void) __attribute__((always_inline));
-static __inline void lcr3(uint32_t val) __attribute__((always_inline));
-static __inline uint32_t rcr3(void) __attribute__((always_inline));
-static __inline void lcr4(uint32_t val) __attribute__((always_inline));
-static __inline uint32_t rcr4(void) __attribute__((always_inline));
+static __inline void lcr0(uintptr_t val) __attribute__((always_inline));
+static __inline uintptr_t rcr0(void) __attribute__((always_inline));
+static __inline uintptr_t rcr2(void) __attribute__((always_inline));
+static __inline void lcr3(uintptr_t val) __attribute__((always_inline));
+static __inline uintptr_t rcr3(void) __attribute__((always_inline));
+static __inline void lcr4(uintptr_t val) __attribute__((always_inline));
+static __inline uintptr_t rcr4(void) __attribute__((always_inline));
 static __inline void tlbflush(void) __attribute__((always_inline));
-static __inline uint32_t read_eflags(void) __attribute__((always_inline));
-static __inline void write_eflags(uint32_t eflags) __attribute__((always_inline));
-static __inline uint32_t read_ebp(void) __attribute__((always_inline));
-static __inline uint32_t read_esp(void) __attribute__((always_inline));
+static __inline void tlbflush_global(void) __attribute__((always_inline));
+static __inline uint64_t rdmsr(uint32_t msr) __attribute__((always_inline));
+static __inline void wrmsr(uint32_t msr, uint64_t val) __attribute__((always_inline));
+static __inline uintptr_t read_eflags(void) __attribute__((always_inline));
+static __inline void write_eflags(uintptr_t eflags) __attribute__((always_inline));
+static __inline uintptr_t read_ebp(void) __attribute__((always_inline));
+static __inline uintptr_t read_esp(void) __attribute__((always_inline));
 static __inline void cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp);
 static __inline uint64_t read_tsc(void) __attribute__((always_inline));
 
@@ -137,6 +143,24 @@ outl(int port, uint32_t data)
 	__asm __volatile("outl %0,%w1" : : "a" (data), "d" (port));
 }
 
+static __inline void
+stosb(void *addr, int data, int cnt)
+{
+	__asm __volatile("cld\n\trep\n\tstosb"			:
+			 "=D" (addr), "=c" (cnt)		:
+			 "0" (addr), "1" (cnt), "a" (data)	:
+			 "memory", "cc");
+}
+
+static __inline void
+stosl(void *addr, int data, int cnt)
+{
+	__asm __volatile("cld\n\trep\n\tstosl"			:
+			 "=D" (addr), "=c" (cnt)		:
+			 "0" (addr), "1" (cnt), "a" (data)	:
+			 "memory", "cc");
+}
+
 static __inline void 
 invlpg(void *addr)
 { 
@@ -161,91 +185,134 @@ ltr(uint16_t sel)
 	__asm __volatile("ltr %0" : : "r" (sel));
 }
 
+// Control registers are as wide as a pointer: 32 bits, or 64 in long
+// mode.  Without a suffix, 'mov' takes its size from the register.
 static __inline void
-lcr0(uint32_t val)
+lcr0(uintptr_t val)
 {
-	__asm __volatile("movl %0,%%cr0" : : "r" (val));
+	__asm __volatile("mov %0,%%cr0" : : "r" (val));
 }
 
-static __inline uint32_t
+static __inline uintptr_t
 rcr0(void)
 {
-	uint32_t val;
-	__asm __volatile("movl %%cr0,%0" : "=r" (val));
+	uintptr_t val;
+	__asm __volatile("mov %%cr0,%0" : "=r" (val));
 	return val;
 }
 
-static __inline uint32_t
+static __inline uintptr_t
 rcr2(void)
 {
-	uint32_t val;
-	__asm __volatile("movl %%cr2,%0" : "=r" (val));
+	uintptr_t val;
+	__asm __volatile("mov %%cr2,%0" : "=r" (val));
 	return val;
 }
 
 static __inline void
-lcr3(uint32_t val)
+lcr3(uintptr_t val)
 {
-	__asm __volatile("movl %0,%%cr3" : : "r" (val));
+	__asm __volatile("mov %0,%%cr3" : : "r" (val));
 }
 
-static __inline uint32_t
+static __inline uintptr_t
 rcr3(void)
 {
-	uint32_t val;
-	__asm __volatile("movl %%cr3,%0" : "=r" (val));
+	uintptr_t val;
+	__asm __volatile("mov %%cr3,%0" : "=r" (val));
 	return val;
 }
 
 static __inline void
-lcr4(uint32_t val)
+lcr4(uintptr_t val)
 {
-	__asm __volatile("movl %0,%%cr4" : : "r" (val));
+	__asm __volatile("mov %0,%%cr4" : : "r" (val));
 }
 
-static __inline uint32_t
+static __inline uintptr_t
 rcr4(void)
 {
-	uint32_t cr4;
-	__asm __volatile("movl %%cr4,%0" : "=r" (cr4));
+	uintptr_t cr4;
+	__asm __volatile("mov %%cr4,%0" : "=r" (cr4));
 	return cr4;
 }
 
 static __inline void
 tlbflush(void)
 {
-	uint32_t cr3;
-	__asm __volatile("movl %%cr3,%0" : "=r" (cr3));
-	__asm __volatile("movl %0,%%cr3" : : "r" (cr3));
+	uintptr_t cr3;
+	__asm __volatile("mov %%cr3,%0" : "=r" (cr3));
+	__asm __volatile("mov %0,%%cr3" : : "r" (cr3));
 }
 
-static __inline uint32_t
+// Reloading %cr3 (tlbflush) leaves global (PTE_G) entries in the TLB;
+// toggling CR4_PGE flushes them too.
+static __inline void
+tlbflush_global(void)
+{
+	uintptr_t cr4 = rcr4();
+
+	if (cr4 & CR4_PGE) {
+		lcr4(cr4 & ~CR4_PGE);
+		lcr4(cr4);
+	} else
+		tlbflush();
+}
+
+// rdmsr, wrmsr and rdtsc split 64-bit values across %edx:%eax.  (The
+// "A" constraint means that pair only in 32-bit code.)
+static __inline uint64_t
+rdmsr(uint32_t msr)
+{
+	uint32_t lo, hi;
+	__asm __volatile("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+	return (uint64_t) hi << 32 | lo;
+}
+
+static __inline void
+wrmsr(uint32_t msr, uint64_t val)
+{
+	__asm __volatile("wrmsr" : : "c" (msr), "a" ((uint32_t) val),
+			 "d" ((uint32_t) (val >> 32)));
+}
+
+static __inline uintptr_t
 read_eflags(void)
 {
-        uint32_t eflags;
-        __asm __volatile("pushfl; popl %0" : "=r" (eflags));
+        uintptr_t eflags;
+        __asm __volatile("pushf; pop %0" : "=r" (eflags));
         return eflags;
 }
 
 static __inline void
-write_eflags(uint32_t eflags)
+write_eflags(uintptr_t eflags)
 {
-        __asm __volatile("pushl %0; popfl" : : "r" (eflags));
+        __asm __volatile("push %0; popf" : : "r" (eflags));
 }
 
-static __inline uint32_t
+// The frame and stack pointers: %ebp and %esp, or %rbp and %rsp in
+// long mode.
+static __inline uintptr_t
 read_ebp(void)
 {
-        uint32_t ebp;
+        uintptr_t ebp;
+#ifdef __x86_64__
+        __asm __volatile("movq %%rbp,%0" : "=r" (ebp));
+#else
         __asm __volatile("movl %%ebp,%0" : "=r" (ebp));
+#endif
         return ebp;
 }
 
-static __inline uint32_t
+static __inline uintptr_t
 read_esp(void)
 {
-        uint32_t esp;
+        uintptr_t esp;
+#ifdef __x86_64__
+        __asm __volatile("movq %%rsp,%0" : "=r" (esp));
+#else
         __asm __volatile("movl %%esp,%0" : "=r" (esp));
+#endif
         return esp;
 }
 
@@ -269,9 +336,9 @@ cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *e
 static __inline uint64_t
 read_tsc(void)
 {
-        uint64_t tsc;
-        __asm __volatile("rdtsc" : "=A" (tsc));
-        return tsc;
+        uint32_t lo, hi;
+        __asm __volatile("rdtsc" : "=a" (lo), "=d" (hi));
+        return (uint64_t) hi << 32 | lo;
 }
 
 #endif /* !JOS_INC_X86_H */
@@ -0,0 +1,131 @@
+/* See COPYRIGHT for copyright information. */
+
+// Boot loader handoff.  The kernel can be started two ways:
+//  - by the JOS boot loader (boot/), which leaves a struct Bootinfo
+//    at physical address BOOTINFO;
+//  - directly by a Multiboot loader such as 'qemu -kernel', which
+//    passes a struct Mbinfo in %ebx.  We convert that into a Bootinfo
+//    so the rest of the kernel sees one format.
+
+#include <inc/string.h>
+#include <inc/multiboot.h>
+
+#include <kern/bootinfo.h>
+#include <kern/pmap.h>
+#include <kern/tsc.h>
+
+// Values of %eax and %ebx at entry, saved by kern/entry.S
+extern uint32_t mb_magic, mb_info;
+
+struct Bootinfo *bootinfo;
+static struct Bootinfo mb_bootinfo;
+
+// Only the memory holding the kernel image is mapped this early (see
+// kern/entrypgdir.c).  Return the kernel virtual address of physical
+// [pa, pa + len), or NULL if that is not all mapped.
+static void *
+early_kaddr(physaddr_t pa, size_t len)
+{
+  if (pa >= boot_mapped || len > boot_mapped - pa)
+    return NULL;
+  return (void *) (KERNBASE + pa);
+}
+
+// Did the boot loader already zero-fill the kernel virtual range
+// [start, end)?  Called before the BSS is cleared, so this must not
+// depend on anything in it.
+bool
+boot_zeroed(char *start, char *end)
+{
+  struct Bootinfo *bi = (struct Bootinfo *) (KERNBASE + BOOTINFO);
+  int i;
+
+  // Under Multiboot, whatever is at BOOTINFO is stale.
+  if (mb_magic == MULTIBOOT_BOOTLOADER_MAGIC
+      || bi->bi_magic != BOOTINFO_MAGIC)
+    return 0;
+  for (i = 0; i < bi->bi_nzeroed && i < BI_NZEROED; i++)
+    if (bi->bi_zeroed[i].start <= (physaddr_t) (start - KERNBASE)
+        && (physaddr_t) (end - KERNBASE) <= bi->bi_zeroed[i].end)
+      return 1;
+  return 0;
+}
+
+static void
+add_e820(struct Bootinfo *bi, uint64_t addr, uint64_t len, uint32_t type)
+{
+  struct E820ent *e;
+
+  if (bi->bi_ne820 >= BI_NE820)
+    return;
+  e = &bi->bi_e820[bi->bi_ne820++];
+  e->addr = addr;
+  e->len = len;
+  e->type = type;
+}
+
+// Build mb_bootinfo from the Multiboot information at physical 'pa':
+// the memory map, the command line and the modules.
+static void
+multiboot_init(physaddr_t pa)
+{
+  struct Bootinfo *bi = &mb_bootinfo;
+  struct Mbinfo *mbi;
+  struct Mbmmap *mm;
+  struct Mbmod *mod;
+  uint8_t *p, *pend;
+  char *s;
+  int i;
+
+  bi->bi_magic = BOOTINFO_MAGIC;
+  bootinfo = bi;
+  // The loader jumped straight to entry.S; now is as close as we can
+  // get to stamping that.
+  boot_stamp(BT_ENTRY, 0);
+
+  if (!(mbi = early_kaddr(pa, sizeof(*mbi))))
+    return;
+
+  if ((mbi->mb_flags & MBI_MMAP)
+      && (p = early_kaddr(mbi->mb_mmap_addr, mbi->mb_mmap_length))) {
+    pend = p + mbi->mb_mmap_length;
+    for (; p + sizeof(*mm) <= pend; p += mm->mm_size + 4) {
+      mm = (struct Mbmmap *) p;
+      add_e820(bi, mm->mm_addr, mm->mm_len, mm->mm_type);
+    }
+  } else if (mbi->mb_flags & MBI_MEMORY) {
+    add_e820(bi, 0, mbi->mb_mem_lower * 1024ULL, E820_RAM);
+    add_e820(bi, EXTPHYSMEM, mbi->mb_mem_upper * 1024ULL, E820_RAM);
+  }
+
+  if ((mbi->mb_flags & MBI_CMDLINE)
+      && (s = early_kaddr(mbi->mb_cmdline, BI_CMDLINE)))
+    strlcpy(bi->bi_cmdline, s, BI_CMDLINE);
+
+  if ((mbi->mb_flags & MBI_MODS)
+      && (mod = early_kaddr(mbi->mb_mods_addr,
+                            mbi->mb_mods_count * sizeof(*mod)))) {
+    for (i = 0; i < mbi->mb_mods_count; i++, mod++) {
+      if (bi->bi_nmods == BI_NMODS)
+        break;
+      bi->bi_mods[bi->bi_nmods].start = mod->mod_start;
+      bi->bi_mods[bi->bi_nmods].end = mod->mod_end;
+      if ((s = early_kaddr(mod->mod_string, 32)))
+        strlcpy(bi->bi_mods[bi->bi_nmods].name, s, 32);
+      bi->bi_nmods++;
+    }
+  }
+}
+
+// Set 'bootinfo' from whichever way we were booted.  Runs before the
+// console is up, so it must not print.
+void
+bootinfo_init(void)
+{
+  struct Bootinfo *bi = (struct Bootinfo *) (KERNBASE + BOOTINFO);
+
+  if (mb_magic == MULTIBOOT_BOOTLOADER_MAGIC)
+    multiboot_init(mb_info);
+  else if (bi->bi_magic == BOOTINFO_MAGIC)
+    bootinfo = bi;
+}
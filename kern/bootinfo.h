@@ -0,0 +1,18 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_BOOTINFO_H
+#define JOS_KERN_BOOTINFO_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/memlayout.h>
+
+// What we were told at boot: the JOS boot loader's Bootinfo block, or
+// one built from a Multiboot loader's information.  NULL if neither.
+extern struct Bootinfo *bootinfo;
+
+bool boot_zeroed(char *start, char *end);
+void bootinfo_init(void);
+
+#endif	// !JOS_KERN_BOOTINFO_H
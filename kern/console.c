@@ -7,6 +7,7 @@
 #include <inc/assert.h>
 
 #include <kern/console.h>
+#include <kern/pmap.h>
 
 static void cons_intr(int (*proc) (void));
 static void cons_putc(int c);
@@ -77,6 +78,17 @@ serial_putc(int c)
   outb(COM1 + COM_TX, c);
 }
 
+// Write a string to the serial port only, for output meant for
+// scripts watching the serial line rather than for people.
+void
+serial_puts(const char *s)
+{
+  if (!serial_exists)
+    return;
+  for (; *s; s++)
+    serial_putc(*s);
+}
+
 static void
 serial_init(void)
 {
@@ -448,8 +460,10 @@ getchar(void)
 {
   int c;
 
+  // Zero free pages while we wait, a page between polls, so a key
+  // press is noticed as soon as the current page is done.
   while ((c = cons_getc()) == 0)
-    /* do nothing */ ;
+    page_scrub();
   return c;
 }
 
@@ -20,6 +20,8 @@
 void cons_init(void);
 int cons_getc(void);
 
+void serial_puts(const char *s);
+
 void kbd_intr(void); // irq 1
 void serial_intr(void); // irq 4
 
@@ -0,0 +1,25 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_CPU_H
+#define JOS_KERN_CPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Maximum number of CPUs
+#define NCPU	8
+
+// Cache line size, for keeping per-CPU data apart
+#define CACHELINE	64
+
+// The index of the CPU we are running on, for per-CPU data.  Only the
+// bootstrap processor (CPU 0) runs until the others are started.
+static inline int
+cpunum(void)
+{
+	return 0;
+}
+
+#endif	// !JOS_KERN_CPU_H
@@ -0,0 +1,64 @@
+#include <inc/mmu.h>
+#include <inc/memlayout.h>
+
+// The x86-64 kernel's boot page tables (make ARCH=x86_64), loaded by
+// kern/entry64.S.  Long mode always translates through four levels, so
+// a PML4 and two page directory pointer tables lead to the page
+// directories, which map 2MB pages (PTE_PS) and stop there.
+//
+// As in the i386 build (kern/entrypgdir.c), we statically map virtual
+// addresses [0, 4MB) and [KERNBASE, KERNBASE+4MB) to physical addresses
+// [0, 4MB).  entry64.S adds 2MB pages at KERNBASE until the whole kernel
+// image is covered, and i386_detect_memory() adds more for the rest of
+// RAM, as far as the top of the address space: KERNBASE is 2GB below
+// it, so entry_kpd is two page directories, each mapping 1GB.
+//
+// All tables must start on a page boundary, hence the "__aligned__"
+// attribute, and are initialized data, since entry64.S fills some in
+// before i386_init() clears the BSS.
+
+extern pae_pde_t entry_pdpt_low[], entry_pdpt_high[];
+extern pae_pde_t entry_idpd[], entry_kpd[];
+
+__attribute__ ((__aligned__(PGSIZE)))
+pae_pde_t entry_pml4[PAE_NPDENTRIES] = {
+  [0]
+      = (uintptr_t) entry_pdpt_low - KERNBASE + PTE_P + PTE_W,
+  [PML4X(KERNBASE)]
+      = (uintptr_t) entry_pdpt_high - KERNBASE + PTE_P + PTE_W,
+};
+
+__attribute__ ((__aligned__(PGSIZE)))
+pae_pde_t entry_pdpt_low[PAE_NPDENTRIES] = {
+  [0] = (uintptr_t) entry_idpd - KERNBASE + PTE_P + PTE_W,
+};
+
+__attribute__ ((__aligned__(PGSIZE)))
+pae_pde_t entry_pdpt_high[PAE_NPDENTRIES] = {
+  [PDPX64(KERNBASE)]
+      = (uintptr_t) entry_kpd - KERNBASE + PTE_P + PTE_W,
+  [PDPX64(KERNBASE) + 1]
+      = (uintptr_t) (entry_kpd + PAE_NPDENTRIES) - KERNBASE + PTE_P + PTE_W,
+};
+
+__attribute__ ((__aligned__(PGSIZE)))
+pae_pde_t entry_idpd[PAE_NPDENTRIES] = {
+  // Map VA's [0, 4MB) to PA's [0, 4MB)
+  [0] = 0x000000 | PTE_P | PTE_PS,
+  [1] = 0x200000 | PTE_P | PTE_PS,
+};
+
+__attribute__ ((__aligned__(PGSIZE)))
+pae_pde_t entry_kpd[2 * PAE_NPDENTRIES] = {
+  // Map VA's [KERNBASE, KERNBASE+4MB) to PA's [0, 4MB)
+  [0] = 0x000000 | PTE_P | PTE_W | PTE_PS | PTE_G,
+  [1] = 0x200000 | PTE_P | PTE_W | PTE_PS | PTE_G,
+};
+
+// Physical memory [0, boot_mapped) is mapped at KERNBASE.  entry64.S
+// and i386_detect_memory() raise it as they add 2MB pages.
+physaddr_t boot_mapped = PTSIZE;
+
+// Long mode paging is PAE paging with a fourth level, so the kernel's
+// PAE code paths apply (see kern/pmap.h).
+uint32_t paging_pae = 1;
@@ -0,0 +1,230 @@
+/* See COPYRIGHT for copyright information. */
+
+// Hibernation: save the machine to disk, so that the next boot picks up
+// right where we left off instead of starting the kernel from scratch.
+//
+// hibernate() records the CPU state with hib_save() (kern/hibswitch.S),
+// then writes every in-use physical page to the disk area the boot
+// manifest reserves, in the format of inc/hibernate.h: runs of pages,
+// with all-zero runs stored as nothing but their extent.  In use means
+// the kernel and its boot_alloc() memory, boot modules, and whatever
+// the page allocator has handed out, in lowmem or highmem; free pages,
+// those cached in magazines included, and pages page_init() kept back
+// for the BIOS, the Bootinfo block and the boot loader are left out.
+// On the next boot the loader restores the pages and jumps to
+// hib_resume, which returns from hib_save() a second time.
+//
+// An image is resumed from once: the resumed kernel invalidates it
+// straight away, so the next boot is a cold one (or resumes from a
+// newer image) instead of going back to the same moment again.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/manifest.h>
+#include <inc/hibernate.h>
+
+#include <kern/hibernate.h>
+#include <kern/ide.h>
+#include <kern/pmap.h>
+#include <kern/console.h>
+#include <kern/bootinfo.h>
+#include <kern/tsc.h>
+
+struct Hibcpu hib_cpu;
+
+static struct Hibrun runs[HIB_MAXRUN];
+static int nrun;
+
+// Highmem pages are copied here to be written, so that no kmap slot is
+// in use while the image is taken.
+static uint8_t bounce[PGSIZE] __attribute__ ((aligned(PGSIZE)));
+
+static bool
+page_zero(ppn_t ppn)
+{
+  uint32_t *p = kmap(ppn);
+  int i;
+
+  for (i = 0; i < PGSIZE / 4; i++)
+    if (p[i])
+      break;
+  kunmap(p);
+  return i == PGSIZE / 4;
+}
+
+// Add page 'ppn' to the run table, extending the last run if we can.
+// Pages must be added in increasing order.
+static int
+add_page(ppn_t ppn)
+{
+  struct Hibrun *r;
+  physaddr_t pa;
+  uint32_t flags;
+
+  // The loader runs in 32-bit mode without paging.
+  if (ppn >= (1ULL << 32) / PGSIZE)
+    return -E_INVAL;
+  pa = (physaddr_t) ppn << PGSHIFT;
+  flags = page_zero(ppn) ? HR_ZERO : 0;
+  if (nrun > 0) {
+    r = &runs[nrun - 1];
+    if (r->hr_flags == flags && r->hr_pa + r->hr_npages * PGSIZE == pa) {
+      r->hr_npages++;
+      return 0;
+    }
+  }
+  if (nrun == HIB_MAXRUN)
+    return -E_NO_MEM;
+  r = &runs[nrun++];
+  r->hr_pa = pa;
+  r->hr_npages = 1;
+  r->hr_flags = flags;
+  return 0;
+}
+
+// Is page 'ppn' part of the image?
+static bool
+page_saved(ppn_t ppn)
+{
+  extern char entry[];
+  int i;
+
+  if (ppn >= PPN(PADDR(entry)) && ppn < page_kern_end)
+    return 1;
+  for (i = 0; bootinfo && i < bootinfo->bi_nmods && i < BI_NMODS; i++)
+    if (ppn >= bootinfo->bi_mods[i].start / PGSIZE
+        && ppn < ROUNDUP(bootinfo->bi_mods[i].end, PGSIZE) / PGSIZE)
+      return 1;
+  // The zero pool's pages must still be zero after a resume; they
+  // cost nothing on disk.
+  return page_allocated(ppn) || pages[ppn].pp_order == PAGE_ZEROPOOL;
+}
+
+// Write the 'npages' pages at physical page 'ppn' to disk at 'sect'.
+static int
+write_pages(uint32_t sect, ppn_t ppn, uint32_t npages)
+{
+  void *va;
+
+  if (ppn + npages <= npages_lowmem)
+    return ide_write(sect, page2kva(&pages[ppn]),
+                     npages * (PGSIZE / SECTSIZE));
+  for (; npages > 0; ppn++, npages--, sect += PGSIZE / SECTSIZE) {
+    va = kmap(ppn);
+    memmove(bounce, va, PGSIZE);
+    kunmap(va);
+    if (ide_write(sect, bounce, PGSIZE / SECTSIZE) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Read the manifest, for the hibernation area and the kernel checksum.
+static int
+read_manifest(uint32_t *sect, uint32_t *nsect, uint32_t *kernsum)
+{
+  static uint8_t buf[SECTSIZE];
+  struct Manifest *mf = (struct Manifest *) buf;
+
+  if (ide_read(MANIFEST_SECT, buf, 1) < 0)
+    return -E_IO;
+  if (mf->mf_magic != MANIFEST_MAGIC || mf->mf_hibnsect == 0)
+    return -E_INVAL;
+  *sect = KERNSECT + mf->mf_hibsect;
+  *nsect = mf->mf_hibnsect;
+  *kernsum = manifest_sum(mf);
+  return 0;
+}
+
+// Write the hibernation image.  Returns 0 once it is on disk, 1 when
+// we come back to life from it, or a negative error code.
+int
+hibernate(void)
+{
+  static uint8_t buf[SECTSIZE];
+  struct Hibhdr *hh = (struct Hibhdr *) buf;
+  struct Bootinfo *bi;
+  uint32_t sect, maxsect, kernsum, nsect, tabsects, s;
+  ppn_t ppn;
+  int i, r;
+
+  if ((r = read_manifest(&sect, &maxsect, &kernsum)) < 0)
+    return r;
+
+  // The Bootinfo page is not ours; the loader fills it in afresh.
+  nrun = 0;
+  for (ppn = 0; ppn < npages; ppn++)
+    if (page_saved(ppn) && (r = add_page(ppn)) < 0) {
+      if (r == -E_NO_MEM)
+        cprintf("hibernate: more than %d runs of pages in use\n",
+                HIB_MAXRUN);
+      return r;
+    }
+
+  tabsects = HIB_TABSECTS(nrun);
+  nsect = 1 + tabsects;
+  for (i = 0; i < nrun; i++)
+    if (!(runs[i].hr_flags & HR_ZERO))
+      nsect += runs[i].hr_npages * (PGSIZE / SECTSIZE);
+  // Report now: after hib_save(), only memory that is dead after a
+  // resume may change.
+  cprintf("hibernate: image needs %u of %u sectors\n", nsect, maxsect);
+  if (nsect > maxsect)
+    return -E_NO_MEM;
+
+  // PTE_NX mappings need EFER_NXE back on before paging is.
+  hib_cpu.hc_efer = boot_nx ? (uint32_t) rdmsr(MSR_EFER) : 0;
+  if (hib_save(&hib_cpu)) {
+    // Back from the boot loader.  Memory is as we left it, but the
+    // devices have been reset and there is a new Bootinfo block.
+    bi = KADDR(BOOTINFO);
+    bootinfo = bi->bi_magic == BOOTINFO_MAGIC ? bi : NULL;
+    cons_init();
+    boot_stamp(BT_CONS, 0);
+    if ((r = hibernate_discard()) < 0)
+      cprintf("hibernate: can't discard the image: %e\n", r);
+    return 1;
+  }
+
+  // From here on, only memory that is dead after a resume changes:
+  // the stack below hib_save's frame and our own buffers.  The header
+  // goes last, so a half-written image is never resumed from.
+  if (ide_write(sect + 1, runs, tabsects) < 0)
+    return -E_IO;
+  s = sect + 1 + tabsects;
+  for (i = 0; i < nrun; i++) {
+    if (runs[i].hr_flags & HR_ZERO)
+      continue;
+    if (write_pages(s, PPN(runs[i].hr_pa), runs[i].hr_npages) < 0)
+      return -E_IO;
+    s += runs[i].hr_npages * (PGSIZE / SECTSIZE);
+  }
+
+  memset(buf, 0, sizeof(buf));
+  hh->hh_magic = HIBERNATE_MAGIC;
+  hh->hh_kernsum = kernsum;
+  hh->hh_resume = (uint32_t) hib_resume - KERNBASE;
+  hh->hh_nrun = nrun;
+  hh->hh_nsect = nsect;
+  if (ide_write(sect, buf, 1) < 0 || ide_flush() < 0)
+    return -E_IO;
+  return 0;
+}
+
+// Invalidate the hibernation image, so the next boot is a cold one.
+int
+hibernate_discard(void)
+{
+  static uint8_t buf[SECTSIZE];
+  uint32_t sect, maxsect, kernsum;
+  int r;
+
+  if ((r = read_manifest(&sect, &maxsect, &kernsum)) < 0)
+    return r;
+  memset(buf, 0, sizeof(buf));
+  if (ide_write(sect, buf, 1) < 0 || ide_flush() < 0)
+    return -E_IO;
+  return 0;
+}
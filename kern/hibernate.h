@@ -0,0 +1,31 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_HIBERNATE_H
+#define JOS_KERN_HIBERNATE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// CPU state hib_save() records and hib_resume restores.  Layout known
+// to kern/hibswitch.S.
+struct Hibcpu {
+	uint32_t hc_ebx;
+	uint32_t hc_esi;
+	uint32_t hc_edi;
+	uint32_t hc_ebp;
+	uint32_t hc_esp;
+	uint32_t hc_eip;
+	uint32_t hc_cr3;
+	uint32_t hc_cr4;
+	uint32_t hc_efer;	// low half of MSR_EFER, or 0 to leave it
+};
+
+int hib_save(struct Hibcpu *hc) __attribute__((returns_twice));
+void hib_resume(void);
+
+int hibernate(void);
+int hibernate_discard(void);
+
+#endif	// !JOS_KERN_HIBERNATE_H
@@ -0,0 +1,112 @@
+/* See COPYRIGHT for copyright information. */
+
+// Minimal PIO driver for the primary master IDE disk, the one we were
+// booted from.  Polls; interrupts stay off.  On machines with no legacy
+// IDE controller (such as q35, which has only AHCI) every call fails
+// with -1 rather than hanging.
+
+#include <inc/x86.h>
+
+#include <kern/ide.h>
+
+#define IDE_BSY		0x80
+#define IDE_DRDY	0x40
+#define IDE_DF		0x20
+#define IDE_ERR		0x01
+
+// Status polls before giving up on the drive.  A port read takes about
+// a microsecond, so this is several seconds.
+#define IDE_TIMEOUT	10000000
+
+// Wait for the drive to be ready.  Returns -1 if there is no drive (an
+// empty bus reads as 0xFF), it stays busy too long, or 'check_error'
+// and it reports an error.
+static int
+ide_wait_ready(bool check_error)
+{
+  int r, i;
+
+  for (i = 0; i < IDE_TIMEOUT; i++) {
+    r = inb(0x1F7);
+    if (r == 0xFF)
+      return -1;
+    if ((r & (IDE_BSY | IDE_DRDY)) == IDE_DRDY)
+      break;
+  }
+  if (i == IDE_TIMEOUT)
+    return -1;
+
+  if (check_error && (r & (IDE_DF | IDE_ERR)) != 0)
+    return -1;
+  return 0;
+}
+
+// Read 'nsecs' sectors starting at 'secno' into 'dst'.
+// Returns 0 on success, -1 on a disk error or if there is no disk.
+int
+ide_read(uint32_t secno, void *dst, size_t nsecs)
+{
+  size_t n;
+
+  while (nsecs > 0) {
+    n = MIN(nsecs, 256);
+    if (ide_wait_ready(0) < 0)
+      return -1;
+
+    outb(0x1F2, n);             // count; 0 means 256
+    outb(0x1F3, secno & 0xFF);
+    outb(0x1F4, (secno >> 8) & 0xFF);
+    outb(0x1F5, (secno >> 16) & 0xFF);
+    outb(0x1F6, 0xE0 | ((secno >> 24) & 0x0F));
+    outb(0x1F7, 0x20);          // CMD 0x20 means read sector
+
+    for (secno += n, nsecs -= n; n > 0; n--) {
+      if (ide_wait_ready(1) < 0)
+        return -1;
+      insl(0x1F0, dst, SECTSIZE / 4);
+      dst = (uint8_t *) dst + SECTSIZE;
+    }
+  }
+  return 0;
+}
+
+// Write 'nsecs' sectors from 'src' starting at 'secno', and wait until
+// the drive has them.  Returns 0 on success, -1 on a disk error or if
+// there is no disk.
+int
+ide_write(uint32_t secno, const void *src, size_t nsecs)
+{
+  size_t n;
+
+  while (nsecs > 0) {
+    n = MIN(nsecs, 256);
+    if (ide_wait_ready(0) < 0)
+      return -1;
+
+    outb(0x1F2, n);
+    outb(0x1F3, secno & 0xFF);
+    outb(0x1F4, (secno >> 8) & 0xFF);
+    outb(0x1F5, (secno >> 16) & 0xFF);
+    outb(0x1F6, 0xE0 | ((secno >> 24) & 0x0F));
+    outb(0x1F7, 0x30);          // CMD 0x30 means write sector
+
+    for (secno += n, nsecs -= n; n > 0; n--) {
+      if (ide_wait_ready(1) < 0)
+        return -1;
+      outsl(0x1F0, src, SECTSIZE / 4);
+      src = (const uint8_t *) src + SECTSIZE;
+    }
+  }
+  return ide_wait_ready(1);
+}
+
+// Make sure everything written so far is on the medium.
+int
+ide_flush(void)
+{
+  if (ide_wait_ready(0) < 0)
+    return -1;
+  outb(0x1F6, 0xE0);
+  outb(0x1F7, 0xE7);            // CMD 0xE7 means flush cache
+  return ide_wait_ready(1);
+}
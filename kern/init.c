@@ -6,6 +6,10 @@
 
 #include <kern/monitor.h>
 #include <kern/console.h>
+#include <kern/pmap.h>
+#include <kern/slab.h>
+#include <kern/bootinfo.h>
+#include <kern/tsc.h>
 
 // Test the stack backtrace function (lab 1 only)
 void
@@ -25,13 +29,26 @@ i386_init(void)
   extern char edata[], end[];
 
   // Before doing anything else, complete the ELF loading process.
-  // Clear the uninitialized global data (BSS) section of our program.
+  // Clear the uninitialized global data (BSS) section of our program,
+  // unless the boot loader already did so while loading us.
   // This ensures that all static/global variables start out zero.
-  memset(edata, 0, end - edata);
+  if (!boot_zeroed(edata, end))
+    memset(edata, 0, end - edata);
+
+  // Find out what the boot loader told us.
+  bootinfo_init();
+  boot_stamp(BT_INIT, 0);
 
   // Initialize the console.
   // Can't call cprintf until after we do this!
   cons_init();
+  boot_stamp(BT_CONS, 0);
+
+  i386_detect_memory();
+  page_init();
+  check_page_alloc();
+  check_vmalloc();
+  slab_init();
 
   cprintf("6828 decimal is %o octal!\n", 6828);
 
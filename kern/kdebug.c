@@ -10,6 +10,11 @@ extern const struct Stab __STAB_END__[];        // End of stabs table
 extern const char __STABSTR_BEGIN__[];  // Beginning of string table
 extern const char __STABSTR_END__[];    // End of string table
 
+// A stab's value as an address.  Stab values are only 32 bits; the
+// x86-64 kernel lives in the top 2GB, so sign extension recovers its
+// addresses.
+#define STAB_ADDR(stab)	((uintptr_t) (int32_t) (stab)->n_value)
+
 // stab_binsearch(stabs, region_left, region_right, type, addr)
 //
 //      Some stab types are arranged in increasing order by instruction
@@ -64,10 +69,10 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
     }
     // actual binary search
     any_matches = 1;
-    if (stabs[m].n_value < addr) {
+    if (STAB_ADDR(&stabs[m]) < addr) {
       *region_left = m;
       l = true_m + 1;
-    } else if (stabs[m].n_value > addr) {
+    } else if (STAB_ADDR(&stabs[m]) > addr) {
       *region_right = m - 1;
       r = m - 1;
     } else {
@@ -150,7 +155,7 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
     // in the string table, but check bounds just in case.
     if (stabs[lfun].n_strx < stabstr_end - stabstr)
       info->eip_fn_name = stabstr + stabs[lfun].n_strx;
-    info->eip_fn_addr = stabs[lfun].n_value;
+    info->eip_fn_addr = STAB_ADDR(&stabs[lfun]);
     addr -= info->eip_fn_addr;
     // Search within the function definition for the line number.
     lline = lfun;
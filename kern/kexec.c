@@ -0,0 +1,302 @@
+/* See COPYRIGHT for copyright information. */
+
+// Warm reboot into a freshly loaded kernel, skipping the BIOS and the
+// boot loader.  The new kernel comes either from the boot disk, read
+// the way the boot loader reads it (through the boot manifest), or
+// from a Multiboot module holding a kernel ELF.  Its segments are
+// staged in lowmem pages taken from the page allocator above the new
+// kernel's load addresses, so nothing the running kernel uses is
+// touched until the jump, and a failed kexec gives them back; the
+// trampoline in kern/kexectramp.S then copies them into place with
+// paging off and jumps to the entry point.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/elf.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/manifest.h>
+#include <inc/lz4.h>
+
+#include <kern/kexec.h>
+#include <kern/ide.h>
+#include <kern/pmap.h>
+#include <kern/bootinfo.h>
+#include <kern/tsc.h>
+
+static struct Kxseg segs[KEXEC_NSEGS];
+static int nsegs;
+static struct Page *stage_pages;	// the staging area
+static size_t stage_npages;
+static physaddr_t stage, stage_end;	// its unused part
+
+// Take 'len' bytes of staging memory (as page-rounded pieces) from the
+// page allocator, above 'top', the end of the new kernel's load
+// addresses, so the trampoline never overwrites a segment it has yet
+// to copy.
+static int
+stage_init(physaddr_t top, uint64_t len)
+{
+  nsegs = 0;
+  stage = stage_end = 0;
+  stage_pages = NULL;
+  if (len > (uint64_t) npages_lowmem * PGSIZE)
+    return -E_NO_MEM;
+  if ((stage_npages = ROUNDUP(len, PGSIZE) / PGSIZE) == 0)
+    return 0;
+  stage_pages = page_alloc_contig_above(stage_npages,
+                                        PPN(ROUNDUP(top, PGSIZE)));
+  if (!stage_pages)
+    return -E_NO_MEM;
+  stage = page2pa(stage_pages);
+  stage_end = stage + stage_npages * PGSIZE;
+  return 0;
+}
+
+// Give the staging area back after a failed kexec.
+static void
+stage_free(void)
+{
+  if (stage_pages)
+    page_free_contig(stage_pages, stage_npages);
+  stage_pages = NULL;
+}
+
+// Reserve 'len' bytes of staging memory; return its physical address,
+// or 0 if it does not fit.
+static physaddr_t
+stage_alloc(size_t len)
+{
+  physaddr_t pa = stage;
+
+  if (len > stage_end - pa)
+    return 0;
+  stage = ROUNDUP(pa + len, PGSIZE);
+  return pa;
+}
+
+// Add a segment to copy from 'src' to [dst, dst + memsz), of which the
+// first 'filesz' bytes are data and the rest zero.
+static int
+add_seg(physaddr_t src, physaddr_t dst, uint32_t filesz, uint32_t memsz)
+{
+  if (nsegs == KEXEC_NSEGS || filesz > memsz || dst < EXTPHYSMEM)
+    return -E_INVAL;
+  segs[nsegs].ks_src = src;
+  segs[nsegs].ks_dst = dst;
+  segs[nsegs].ks_filesz = filesz;
+  segs[nsegs].ks_memsz = memsz;
+  nsegs++;
+  return 0;
+}
+
+// Decompress a 4-byte length + LZ4 block of at most 'len' bytes at
+// 'src' into 'filesz' bytes at 'dst'.
+static int
+unpack(void *src, size_t len, void *dst, uint32_t filesz)
+{
+  uint32_t csize;
+
+  if (len < 4)
+    return -E_INVAL;
+  memmove(&csize, src, 4);
+  if (csize > len - 4
+      || lz4_decompress((uint8_t *) src + 4, csize, dst, filesz) != filesz)
+    return -E_INVAL;
+  return 0;
+}
+
+// Hand the Bootinfo on to the new kernel, copy the trampoline and the
+// segment list to low memory, and jump.  Does not return.
+static void
+kexec_start(uint32_t entry)
+{
+  extern char kexec_tramp[], kexec_tramp_end[];
+  struct Bootinfo *bi = KADDR(BOOTINFO);
+  void (*tramp)(physaddr_t, int, uint32_t);
+  int i;
+
+  // The new kernel finds the Bootinfo at BOOTINFO, even if we were
+  // booted by a Multiboot loader.  The trampoline zero-fills each
+  // segment's tail, so the new kernel need not.
+  if (bootinfo && bootinfo != bi)
+    memmove(bi, bootinfo, sizeof(*bi));
+  bi->bi_magic = BOOTINFO_MAGIC;
+  bi->bi_nstamp = 0;
+  bi->bi_nzeroed = 0;
+  for (i = 0; i < nsegs && bi->bi_nzeroed < BI_NZEROED; i++) {
+    if (segs[i].ks_memsz == segs[i].ks_filesz)
+      continue;
+    bi->bi_zeroed[bi->bi_nzeroed].start = segs[i].ks_dst + segs[i].ks_filesz;
+    bi->bi_zeroed[bi->bi_nzeroed].end = segs[i].ks_dst + segs[i].ks_memsz;
+    bi->bi_nzeroed++;
+  }
+  bootinfo = bi;
+  boot_stamp(BT_KEXEC, 0);
+
+  // Write through the KERNBASE mapping; the identity mapping of low
+  // memory is read-only.  Then run the trampoline at its identity-
+  // mapped address, where it keeps running once paging is off.
+  memmove(KADDR(KEXEC_TRAMP), kexec_tramp, kexec_tramp_end - kexec_tramp);
+  memmove(KADDR(KEXEC_SEGS), segs, nsegs * sizeof(segs[0]));
+  tramp = (void (*)(physaddr_t, int, uint32_t)) KEXEC_TRAMP;
+  tramp(KEXEC_SEGS, nsegs, entry);
+}
+
+// Stage the kernel segments 'mf' lists from the boot disk and boot the
+// kernel.  Returns only on failure.
+static int
+disk_load(struct Manifest *mf)
+{
+  struct Mfentry *me;
+  physaddr_t pa, zpa;
+  int i, r;
+
+  // Same order as the boot loader: one forward sweep over the disk.
+  for (i = 0; i < mf->mf_nent; i++) {
+    me = &mf->mf_ents[i];
+    if (!(me->me_flags & MF_LZ4)) {
+      // read into staging; the trampoline copies it into place
+      if (me->me_nsect * SECTSIZE < me->me_filesz)
+        return -E_INVAL;
+      if (!(pa = zpa = stage_alloc(me->me_nsect * SECTSIZE)))
+        return -E_NO_MEM;
+    } else if (!(pa = stage_alloc(me->me_filesz))
+               || !(zpa = stage_alloc(me->me_nsect * SECTSIZE)))
+      return -E_NO_MEM;
+    if (ide_read(KERNSECT + me->me_sect, KADDR(zpa), me->me_nsect) < 0)
+      return -E_IO;
+    if ((me->me_flags & MF_LZ4)
+        && (r = unpack(KADDR(zpa), me->me_nsect * SECTSIZE, KADDR(pa),
+                       me->me_filesz)) < 0)
+      return r;
+    if ((r = add_seg(pa, me->me_pa, me->me_filesz, me->me_memsz)) < 0)
+      return r;
+  }
+
+  kexec_start(mf->mf_entry);
+  return -E_UNSPECIFIED;
+}
+
+// Load the kernel from the boot disk and boot it.  Returns only on
+// failure.
+int
+kexec_disk(void)
+{
+  static uint8_t buf[SECTSIZE];
+  struct Manifest *mf = (struct Manifest *) buf;
+  struct Mfentry *me;
+  physaddr_t top;
+  uint64_t len;
+  int i, r;
+
+  static_assert(KEXEC_SEGS + KEXEC_NSEGS * sizeof(struct Kxseg) <= 0x7C00);
+  static_assert(sizeof(struct Manifest) <= SECTSIZE);
+
+  if (ide_read(MANIFEST_SECT, buf, 1) < 0)
+    return -E_IO;
+  if (mf->mf_magic != MANIFEST_MAGIC || mf->mf_nent > MF_NENT)
+    return -E_INVAL;
+
+  // Staging holds each segment as read from disk, and decompressed too
+  // if it is LZ4.
+  top = 0;
+  len = 0;
+  for (i = 0; i < mf->mf_nent; i++) {
+    me = &mf->mf_ents[i];
+    top = MAX(top, me->me_pa + me->me_memsz);
+    len += ROUNDUP((uint64_t) me->me_nsect * SECTSIZE, PGSIZE);
+    if (me->me_flags & MF_LZ4)
+      len += ROUNDUP((uint64_t) me->me_filesz, PGSIZE);
+  }
+  if ((r = stage_init(top, len)) < 0)
+    return r;
+  r = disk_load(mf);
+  stage_free();
+  return r;
+}
+
+// Stage the segments of the kernel ELF 'elf', a module at physical
+// [start, end), and boot it.  Returns only on failure.
+static int
+module_load(struct Elf *elf, physaddr_t start, physaddr_t end)
+{
+  struct Proghdr *ph, *eph;
+  physaddr_t pa;
+  int r;
+
+  ph = (struct Proghdr *) ((uint8_t *) elf + elf->e_phoff);
+  eph = ph + elf->e_phnum;
+  for (; ph < eph; ph++) {
+    if (ph->p_type != ELF_PROG_LOAD || ph->p_memsz == 0)
+      continue;
+    if (ph->p_offset > end - start)
+      return -E_INVAL;
+    if (!(ph->p_flags & ELF_PROG_FLAG_LZ4)) {
+      if (ph->p_filesz > end - start - ph->p_offset)
+        return -E_INVAL;
+      pa = start + ph->p_offset;
+    } else {
+      if (!(pa = stage_alloc(ph->p_filesz)))
+        return -E_NO_MEM;
+      if ((r = unpack((uint8_t *) elf + ph->p_offset,
+                      end - start - ph->p_offset, KADDR(pa),
+                      ph->p_filesz)) < 0)
+        return r;
+    }
+    if ((r = add_seg(pa, ph->p_pa, ph->p_filesz, ph->p_memsz)) < 0)
+      return r;
+  }
+
+  kexec_start(elf->e_entry);
+  return -E_UNSPECIFIED;
+}
+
+// Boot the kernel ELF in Multiboot module 'mod'.  Uncompressed segments
+// are copied straight from the module; LZ4 ones (from a kernel packed
+// by kern/mkimg.c) are decompressed into staging memory first.
+// Returns only on failure.
+int
+kexec_module(int mod)
+{
+  struct Elf *elf;
+  struct Proghdr *ph, *eph;
+  physaddr_t start, end, top;
+  uint64_t len;
+  int r;
+
+  if (!bootinfo || mod < 0 || mod >= bootinfo->bi_nmods)
+    return -E_INVAL;
+  start = bootinfo->bi_mods[mod].start;
+  end = bootinfo->bi_mods[mod].end;
+  if (end > boot_mapped || end < start || end - start < sizeof(*elf))
+    return -E_INVAL;
+
+  elf = KADDR(start);
+  if (elf->e_magic != ELF_MAGIC
+      || elf->e_phoff + elf->e_phnum * sizeof(*ph) > end - start)
+    return -E_INVAL;
+  ph = (struct Proghdr *) ((uint8_t *) elf + elf->e_phoff);
+  eph = ph + elf->e_phnum;
+
+  // The module itself must survive until the trampoline has copied
+  // from it, so it must not overlap the new kernel.  Only LZ4
+  // segments need staging.
+  top = 0;
+  len = 0;
+  for (; ph < eph; ph++) {
+    if (ph->p_type != ELF_PROG_LOAD)
+      continue;
+    if (ph->p_pa < end && start < ph->p_pa + ph->p_memsz)
+      return -E_INVAL;
+    top = MAX(top, ph->p_pa + ph->p_memsz);
+    if (ph->p_flags & ELF_PROG_FLAG_LZ4)
+      len += ROUNDUP((uint64_t) ph->p_filesz, PGSIZE);
+  }
+  if ((r = stage_init(top, len)) < 0)
+    return r;
+  r = module_load(elf, start, end);
+  stage_free();
+  return r;
+}
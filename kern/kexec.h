@@ -0,0 +1,29 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KEXEC_H
+#define JOS_KERN_KEXEC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Physical addresses the kexec trampoline and its segment list are
+// copied to: free memory below the boot sector (whose GDT we still use).
+#define KEXEC_TRAMP	0x7000
+#define KEXEC_SEGS	0x7400
+#define KEXEC_NSEGS	20
+
+// A segment of the new kernel, staged in memory and waiting to be
+// copied to its load address.  Layout known to kern/kexectramp.S.
+struct Kxseg {
+	physaddr_t ks_src;	// staging address
+	physaddr_t ks_dst;	// load address
+	uint32_t ks_filesz;	// bytes to copy
+	uint32_t ks_memsz;	// ks_filesz plus bytes to zero-fill
+};
+
+int kexec_disk(void);
+int kexec_module(int mod);
+
+#endif	// !JOS_KERN_KEXEC_H
@@ -0,0 +1,335 @@
+/*
+ * Host tool: pack the kernel ELF image for the boot loader.
+ *
+ *	mkimg kernel packed manifest [hibsects]
+ *
+ * 'kernel' may be a 32-bit (i386) or a 64-bit (x86-64) ELF file.
+ * The ELF and program headers are copied to the start of 'packed'.
+ * The file contents of each PT_LOAD segment follow, each starting on a
+ * sector boundary, with the segment's p_offset rewritten to match.  A
+ * segment that LZ4 compresses well is stored as a 4-byte compressed
+ * length followed by a raw LZ4 block, and gets ELF_PROG_FLAG_LZ4 in
+ * p_flags.  Section headers are dropped, since nothing at boot time
+ * reads them.
+ *
+ * 'manifest' gets the boot manifest (inc/manifest.h) describing the
+ * same segments as sector runs of 'packed', in disk order.  The boot
+ * loader reads only the manifest, never the ELF headers.  If 'hibsects'
+ * is given, the manifest also reserves that many sectors right after
+ * the packed kernel for a hibernation image (inc/hibernate.h).
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <inc/elf.h>
+#include <inc/manifest.h>
+
+#define SECTSIZE	512
+#define HASHLOG		16
+
+static void
+die(const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "mkimg: ");
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  exit(1);
+}
+
+static uint8_t *
+readfile(const char *name, size_t *lenp)
+{
+  FILE *f;
+  uint8_t *buf;
+  long len;
+
+  if ((f = fopen(name, "rb")) == NULL)
+    die("open %s: %m", name);
+  fseek(f, 0, SEEK_END);
+  len = ftell(f);
+  rewind(f);
+  if ((buf = malloc(len)) == NULL)
+    die("out of memory");
+  if (fread(buf, 1, len, f) != (size_t) len)
+    die("read %s: %m", name);
+  fclose(f);
+  *lenp = len;
+  return buf;
+}
+
+/***** LZ4 block encoder (see lib/lz4.c for the format) *****/
+
+static uint32_t
+read32(const uint8_t *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static uint32_t
+hash4(uint32_t v)
+{
+  return (v * 2654435761U) >> (32 - HASHLOG);
+}
+
+// Emit the extension bytes of a length whose nibble was 15.
+static uint8_t *
+putlen(uint8_t *op, size_t len)
+{
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+// Emit one sequence; mlen == 0 means literals only (the last sequence).
+static uint8_t *
+putseq(uint8_t *op, const uint8_t *lit, size_t litlen, size_t off, size_t mlen)
+{
+  uint8_t *token = op++;
+
+  *token = (litlen < 15 ? litlen : 15) << 4;
+  if (litlen >= 15)
+    op = putlen(op, litlen - 15);
+  memcpy(op, lit, litlen);
+  op += litlen;
+  if (mlen == 0)
+    return op;
+
+  *op++ = off;
+  *op++ = off >> 8;
+  mlen -= 4;
+  *token |= mlen < 15 ? mlen : 15;
+  if (mlen >= 15)
+    op = putlen(op, mlen - 15);
+  return op;
+}
+
+// Greedy single-probe compressor.  'dst' must hold lz4_bound(n) bytes.
+// The format requires the last 5 bytes to be literals and the last
+// match to start at least 12 bytes before the end.
+static size_t
+lz4_bound(size_t n)
+{
+  return n + n / 255 + 16;
+}
+
+static size_t
+lz4_compress(const uint8_t *src, size_t n, uint8_t *dst)
+{
+  static uint32_t hashtab[1 << HASHLOG];	// position + 1, 0 if empty
+  const uint8_t *ip = src, *anchor = src, *end = src + n, *ref;
+  uint8_t *op = dst;
+  uint32_t h, v, cand;
+  size_t mlen;
+
+  memset(hashtab, 0, sizeof(hashtab));
+  while (end - ip >= 12) {
+    v = read32(ip);
+    h = hash4(v);
+    cand = hashtab[h];
+    hashtab[h] = ip - src + 1;
+    ref = src + cand - 1;
+    if (cand == 0 || ip - ref > 65535 || read32(ref) != v) {
+      ip++;
+      continue;
+    }
+    for (mlen = 4; ip + mlen < end - 5 && ip[mlen] == ref[mlen]; mlen++)
+      ;
+    op = putseq(op, anchor, ip - anchor, ip - ref, mlen);
+    ip += mlen;
+    anchor = ip;
+  }
+  op = putseq(op, anchor, end - anchor, 0, 0);
+  return op - dst;
+}
+
+/***** Packing the kernel *****/
+
+// Program headers are handled in their 64-bit form, and converted
+// from and to the 32-bit form for an i386 kernel.
+static int elf64;
+
+static void
+getph(const uint8_t *p, struct Proghdr64 *ph)
+{
+  const struct Proghdr *ph32 = (const struct Proghdr *) p;
+
+  if (elf64) {
+    memcpy(ph, p, sizeof(*ph));
+    return;
+  }
+  ph->p_type = ph32->p_type;
+  ph->p_flags = ph32->p_flags;
+  ph->p_offset = ph32->p_offset;
+  ph->p_va = ph32->p_va;
+  ph->p_pa = ph32->p_pa;
+  ph->p_filesz = ph32->p_filesz;
+  ph->p_memsz = ph32->p_memsz;
+  ph->p_align = ph32->p_align;
+}
+
+static void
+putph(uint8_t *p, const struct Proghdr64 *ph)
+{
+  struct Proghdr *ph32 = (struct Proghdr *) p;
+
+  if (elf64) {
+    memcpy(p, ph, sizeof(*ph));
+    return;
+  }
+  ph32->p_type = ph->p_type;
+  ph32->p_flags = ph->p_flags;
+  ph32->p_offset = ph->p_offset;
+  ph32->p_va = ph->p_va;
+  ph32->p_pa = ph->p_pa;
+  ph32->p_filesz = ph->p_filesz;
+  ph32->p_memsz = ph->p_memsz;
+  ph32->p_align = ph->p_align;
+}
+
+static int
+mfcmp(const void *a, const void *b)
+{
+  const struct Mfentry *x = a, *y = b;
+
+  return x->me_sect < y->me_sect ? -1 : x->me_sect > y->me_sect;
+}
+
+int
+main(int argc, char **argv)
+{
+  uint8_t *in, *out, *z;
+  size_t inlen, outlen, hdrlen, phsize, zlen, rawtotal, total;
+  uint64_t phoff, entry;
+  uint32_t off, csize;
+  struct Elf *elf;
+  struct Elf64 *elf64h;
+  struct Proghdr64 ph;
+  struct Manifest mf;
+  struct Mfentry *me;
+  FILE *f;
+  int i, phnum;
+
+  if (argc != 4 && argc != 5)
+    die("usage: mkimg kernel packed manifest [hibsects]");
+
+  in = readfile(argv[1], &inlen);
+  elf = (struct Elf *) in;
+  elf64h = (struct Elf64 *) in;
+  if (inlen < sizeof(*elf) || elf->e_magic != ELF_MAGIC)
+    die("%s: not an ELF file", argv[1]);
+  elf64 = elf->e_elf[0] == ELF_CLASS_64;
+  if (elf64) {
+    if (inlen < sizeof(*elf64h))
+      die("%s: not an ELF file", argv[1]);
+    phoff = elf64h->e_phoff;
+    phnum = elf64h->e_phnum;
+    entry = elf64h->e_entry;
+    phsize = sizeof(struct Proghdr64);
+  } else {
+    phoff = elf->e_phoff;
+    phnum = elf->e_phnum;
+    entry = elf->e_entry;
+    phsize = sizeof(struct Proghdr);
+  }
+  hdrlen = phoff + phnum * phsize;
+  if (hdrlen > inlen || hdrlen > 8 * SECTSIZE)
+    die("%s: program headers past the first page", argv[1]);
+  // The boot loader runs in 32-bit protected mode.
+  if (entry > 0xFFFFFFFF)
+    die("%s: entry point above 4GB", argv[1]);
+
+  // Worst case: every segment grows a little and gets sector-aligned.
+  outlen = hdrlen + SECTSIZE;
+  for (i = 0; i < phnum; i++) {
+    getph(in + phoff + i * phsize, &ph);
+    outlen += lz4_bound(ph.p_filesz) + 4 + SECTSIZE;
+  }
+  if ((out = calloc(1, outlen)) == NULL || (z = malloc(outlen)) == NULL)
+    die("out of memory");
+
+  memcpy(out, in, hdrlen);
+  if (elf64) {
+    elf64h = (struct Elf64 *) out;
+    elf64h->e_shoff = 0;
+    elf64h->e_shnum = 0;
+    elf64h->e_shstrndx = ELF_SHN_UNDEF;
+  } else {
+    elf = (struct Elf *) out;
+    elf->e_shoff = 0;
+    elf->e_shnum = 0;
+    elf->e_shstrndx = ELF_SHN_UNDEF;
+  }
+
+  memset(&mf, 0, sizeof(mf));
+  mf.mf_magic = MANIFEST_MAGIC;
+  mf.mf_entry = entry;
+
+  off = (hdrlen + SECTSIZE - 1) & ~(SECTSIZE - 1);
+  rawtotal = total = 0;
+  for (i = 0; i < phnum; i++) {
+    getph(out + phoff + i * phsize, &ph);
+    if (ph.p_type != ELF_PROG_LOAD || ph.p_memsz == 0)
+      continue;
+    if (ph.p_pa + ph.p_memsz > 0x100000000ULL)
+      die("%s: segment %d above 4GB", argv[1], i);
+    if (mf.mf_nent == MF_NENT)
+      die("%s: more than %d loadable segments", argv[1], MF_NENT);
+    me = &mf.mf_ents[mf.mf_nent++];
+    me->me_sect = off / SECTSIZE;
+    me->me_pa = ph.p_pa;
+    me->me_filesz = ph.p_filesz;
+    me->me_memsz = ph.p_memsz;
+    if (ph.p_filesz == 0)
+      continue;
+    if (ph.p_offset + ph.p_filesz > inlen)
+      die("%s: segment %d past end of file", argv[1], i);
+
+    zlen = lz4_compress(in + ph.p_offset, ph.p_filesz, z + 4);
+    if (zlen + 4 < ph.p_filesz) {
+      csize = zlen;
+      memcpy(z, &csize, 4);
+      memcpy(out + off, z, zlen + 4);
+      ph.p_flags |= ELF_PROG_FLAG_LZ4;
+      me->me_flags |= MF_LZ4;
+      zlen += 4;
+    } else {
+      memcpy(out + off, in + ph.p_offset, ph.p_filesz);
+      zlen = ph.p_filesz;
+    }
+    ph.p_offset = off;
+    putph(out + phoff + i * phsize, &ph);
+    me->me_nsect = (zlen + SECTSIZE - 1) / SECTSIZE;
+    off += me->me_nsect * SECTSIZE;
+    rawtotal += ph.p_filesz;
+    total += zlen;
+  }
+
+  if ((f = fopen(argv[2], "wb")) == NULL)
+    die("open %s: %m", argv[2]);
+  if (fwrite(out, 1, off, f) != off || fclose(f) != 0)
+    die("write %s: %m", argv[2]);
+
+  // Segments were packed in header order; the loader wants disk order.
+  qsort(mf.mf_ents, mf.mf_nent, sizeof(mf.mf_ents[0]), mfcmp);
+  mf.mf_hibsect = off / SECTSIZE;
+  mf.mf_hibnsect = argc == 5 ? strtoul(argv[4], NULL, 0) : 0;
+  if ((f = fopen(argv[3], "wb")) == NULL)
+    die("open %s: %m", argv[3]);
+  if (fwrite(&mf, sizeof(mf), 1, f) != 1 || fclose(f) != 0)
+    die("write %s: %m", argv[3]);
+  fprintf(stderr, "kernel segments packed from %zu to %zu bytes\n",
+          rawtotal, total);
+  return 0;
+}
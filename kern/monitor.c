@@ -10,6 +10,14 @@
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/pmap.h>
+#include <kern/slab.h>
+#include <kern/bootinfo.h>
+#include <kern/tsc.h>
+#ifndef __x86_64__
+#include <kern/kexec.h>
+#include <kern/hibernate.h>
+#endif
 
 #define CMDBUF_SIZE	80      // enough for one VGA text line
 
@@ -24,11 +32,23 @@ static struct Command commands[] = {
   {"help", "Display this list of commands", mon_help},
   {"kerninfo", "Display information about the kernel", mon_kerninfo},
   {"backtrace", "Backtrace Current Call-Stack", mon_backtrace},
+  {"boottime", "Display where boot time went", mon_boottime},
+  {"buddyinfo", "Display free page blocks and fragmentation",
+   mon_buddyinfo},
+  {"pagemag", "Display page magazine and pre-zeroed pool hit rates",
+   mon_pagemag},
+  {"slabinfo", "Display slab allocator usage", mon_slabinfo},
+#ifndef __x86_64__
+  {"kexec", "Boot a new kernel from disk or module N: kexec [N]",
+   mon_kexec},
+  {"hibernate", "Save the machine to disk (-d: discard the saved image)",
+   mon_hibernate},
+#endif
 };
 
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
-unsigned read_eip();
+uintptr_t read_eip(void);
 
 /***** Implementations of basic kernel monitor commands *****/
 
@@ -46,14 +66,20 @@ int
 mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 {
   extern char entry[], etext[], edata[], end[];
+  int i;
 
   cprintf("Special kernel symbols:\n");
-  cprintf("  entry  %08x (virt)  %08x (phys)\n", entry, entry - KERNBASE);
-  cprintf("  etext  %08x (virt)  %08x (phys)\n", etext, etext - KERNBASE);
-  cprintf("  edata  %08x (virt)  %08x (phys)\n", edata, edata - KERNBASE);
-  cprintf("  end    %08x (virt)  %08x (phys)\n", end, end - KERNBASE);
+  cprintf("  entry  %08lx (virt)  %08lx (phys)\n", entry, entry - KERNBASE);
+  cprintf("  etext  %08lx (virt)  %08lx (phys)\n", etext, etext - KERNBASE);
+  cprintf("  edata  %08lx (virt)  %08lx (phys)\n", edata, edata - KERNBASE);
+  cprintf("  end    %08lx (virt)  %08lx (phys)\n", end, end - KERNBASE);
   cprintf("Kernel executable memory footprint: %dKB\n",
           (end - entry + 1023) / 1024);
+  if (bootinfo && bootinfo->bi_cmdline[0])
+    cprintf("Kernel command line: %s\n", bootinfo->bi_cmdline);
+  for (i = 0; bootinfo && i < bootinfo->bi_nmods && i < BI_NMODS; i++)
+    cprintf("Module %d: [%08x, %08x) %s\n", i, bootinfo->bi_mods[i].start,
+            bootinfo->bi_mods[i].end, bootinfo->bi_mods[i].name);
   return 0;
 }
 
@@ -61,8 +87,8 @@ int
 mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 {
   // Your code here.
-  uint32_t ebp,eip;
-  uint32_t arg;
+  uintptr_t ebp,eip;
+  uintptr_t arg;
   int i, nargs;
   struct Eipdebuginfo info= {};
   char fnbuf[256];
@@ -75,21 +101,286 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf)
     // get debuginfo
     (void)debuginfo_eip((uintptr_t)eip, &info);
     nargs = info.eip_fn_narg;
+#ifdef __x86_64__
+    // arguments are passed in registers, not on the stack
+    nargs = 0;
+#endif
     // print stack info
-    cprintf("  ebp %08x  eip %08x  args", ebp, eip);
+    cprintf("  ebp %08lx  eip %08lx  args", ebp, eip);
     for (i = 0; i < nargs; i++) {
-      arg = *(((uint32_t *) ebp) + 2 + i);
-      cprintf(" %08x", arg);
+      arg = *(((uintptr_t *) ebp) + 2 + i);
+      cprintf(" %08lx", arg);
     }
     // print symbol info
     cprintf("\n        %s:%d:   %.*s+%d\n", info.eip_file, info.eip_line, info.eip_fn_namelen, info.eip_fn_name, (eip - info.eip_fn_addr));
     // trace back: next eip,ebp
-    eip = *(((uint32_t *) ebp) + 1);
-    ebp = *((uint32_t *) ebp);
+    eip = *(((uintptr_t *) ebp) + 1);
+    ebp = *((uintptr_t *) ebp);
+  }
+  return 0;
+}
+
+static const char *const bt_names[] = {
+  [BT_START] = "start",
+  [BT_BOOTMAIN] = "bootmain",
+  [BT_SEGMENT] = "segment",
+  [BT_BSS] = "bss",
+  [BT_ENTRY] = "entry",
+  [BT_INIT] = "i386_init",
+  [BT_CONS] = "cons_init",
+  [BT_MONITOR] = "monitor",
+  [BT_KEXEC] = "kexec",
+  [BT_RESUME] = "resume",
+};
+
+// Format the name of boot timeline point 'bs' into 'buf'.
+static void
+bt_label(struct Bootstamp *bs, char *buf, int n)
+{
+  const char *name = "?";
+
+  if (bs->bs_id < sizeof(bt_names) / sizeof(bt_names[0])
+      && bt_names[bs->bs_id])
+    name = bt_names[bs->bs_id];
+  if (bs->bs_id == BT_SEGMENT)
+    snprintf(buf, n, "%s%u", name, bs->bs_arg);
+  else
+    snprintf(buf, n, "%s", name);
+}
+
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf)
+{
+  struct Bootinfo *bi = bootinfo;
+  struct Bootstamp *bs;
+  uint64_t prev, delta;
+  uint32_t khz;
+  char label[16];
+  int i;
+
+  if (!bi || bi->bi_nstamp == 0) {
+    cprintf("No boot timeline\n");
+    return 0;
+  }
+
+  // Each row is the time from the previous point up to this one.
+  // The first row is the time from CPU reset to boot.S, which is
+  // mostly the BIOS.
+  // If the TSC could not be calibrated (it is stopped, or there is no
+  // PIT), there are only cycles to show.
+  khz = tsc_khz();
+  if (khz)
+    cprintf("TSC at %u kHz\n", khz);
+  else
+    cprintf("TSC rate unknown; showing cycles only\n");
+  cprintf("  %-12s %14s %10s %10s\n", "phase", "cycles", "us", "total us");
+  prev = 0;
+  for (i = 0; i < bi->bi_nstamp && i < BI_NSTAMP; i++) {
+    bs = &bi->bi_stamps[i];
+    delta = bs->bs_tsc - prev;
+    prev = bs->bs_tsc;
+    bt_label(bs, label, sizeof(label));
+    if (khz)
+      cprintf("  %-12s %14llu %10llu %10llu\n", label, delta,
+              delta * 1000 / khz, bs->bs_tsc * 1000 / khz);
+    else
+      cprintf("  %-12s %14llu %10s %10s\n", label, delta, "-", "-");
   }
   return 0;
 }
 
+// For each zone, the free blocks of each order, and how much of the
+// zone's free memory is in blocks too small for an allocation of that
+// order ("unusable"; 0% means none of it is).
+int
+mon_buddyinfo(int argc, char **argv, struct Trapframe *tf)
+{
+  struct PageZone *z;
+  size_t nfree, ncached, below;
+  int i, o;
+
+  for (i = 0; i < NZONES; i++) {
+    z = &page_zones[i];
+    if (z->pz_end == z->pz_start)
+      continue;
+    nfree = 0;
+    for (o = 0; o < PAGE_NORDER; o++)
+      nfree += z->pz_nfree[o] << o;
+    // Magazines and the zero pool hold lowmem pages only.
+    ncached = 0;
+    if (i == ZONE_LOWMEM) {
+      ncached = page_zero_pool.zp_count;
+      for (o = 0; o < NCPU; o++)
+        ncached += page_mags[o].pm_count;
+    }
+    cprintf("Zone %s: %lu pages, %lu free (%lu cached), "
+            "longest free run %lu\n",
+            z->pz_name, (size_t) (z->pz_end - z->pz_start), nfree + ncached,
+            ncached, page_free_run_max(z));
+    cprintf("  %5s %8s %8s %9s\n", "order", "size", "blocks", "unusable");
+    below = 0;
+    for (o = 0; o < PAGE_NORDER; o++) {
+      cprintf("  %5d %7dK %8lu %8lu%%\n", o, (PGSIZE / 1024) << o,
+              z->pz_nfree[o], nfree ? below * 100 / nfree : 0);
+      below += z->pz_nfree[o] << o;
+    }
+  }
+  return 0;
+}
+
+// Each CPU's page magazine: pages held, and how many allocations and
+// frees it served without going to the buddy allocator.  Then the
+// pre-zeroed page pool.
+int
+mon_pagemag(int argc, char **argv, struct Trapframe *tf)
+{
+  struct PageZeroPool *zp = &page_zero_pool;
+  struct PageMag *pm;
+  uint64_t nzero;
+  int i;
+
+  cprintf("  %3s %5s %10s %5s %10s %5s %7s %7s\n", "cpu", "held",
+          "allocs", "hit%", "frees", "hit%", "refills", "drains");
+  for (i = 0; i < NCPU; i++) {
+    pm = &page_mags[i];
+    if (pm->pm_alloc == 0 && pm->pm_free == 0)
+      continue;
+    cprintf("  %3d %5d %10llu %5llu %10llu %5llu %7u %7u\n",
+            i, pm->pm_count,
+            pm->pm_alloc,
+            pm->pm_alloc ? pm->pm_alloc_hit * 100 / pm->pm_alloc : 0,
+            pm->pm_free,
+            pm->pm_free ? pm->pm_free_hit * 100 / pm->pm_free : 0,
+            pm->pm_refill, pm->pm_drain);
+  }
+  nzero = zp->zp_hit + zp->zp_miss;
+  cprintf("Pre-zeroed pool: %u pages, %llu scrubbed; "
+          "%llu%% of %llu ALLOC_ZERO pages from the pool\n",
+          zp->zp_count, zp->zp_scrubbed,
+          nzero ? zp->zp_hit * 100 / nzero : 0, nzero);
+  return 0;
+}
+
+// For each slab cache: object size, objects allocated ("active", not
+// counting those waiting in CPU caches) and room for them, slabs, and
+// how many allocations the CPU caches served.
+int
+mon_slabinfo(int argc, char **argv, struct Trapframe *tf)
+{
+  struct KmemCache *kc;
+  struct Slab *sl;
+  uint32_t inuse, cached, alloc, hit;
+  int i;
+
+  cprintf("  %-14s %6s %8s %8s %6s %6s %5s\n", "cache", "size",
+          "active", "total", "slabs", "cached", "hit%");
+  LIST_FOREACH(kc, &kmem_caches, kc_link) {
+    inuse = 0;
+    LIST_FOREACH(sl, &kc->kc_partial, sl_link)
+      inuse += sl->sl_inuse;
+    LIST_FOREACH(sl, &kc->kc_full, sl_link)
+      inuse += sl->sl_inuse;
+    cached = alloc = hit = 0;
+    for (i = 0; i < NCPU; i++) {
+      cached += kc->kc_cpu[i].cc_count;
+      alloc += kc->kc_cpu[i].cc_alloc;
+      hit += kc->kc_cpu[i].cc_alloc_hit;
+    }
+    cprintf("  %-14s %6lu %8u %8u %6u %6u %5u\n", kc->kc_name,
+            kc->kc_size, inuse - cached, kc->kc_nslabs * kc->kc_perslab,
+            kc->kc_nslabs, cached, alloc ? hit * 100 / alloc : 0);
+  }
+  return 0;
+}
+
+// kexec and hibernation are i386 only: their trampolines are 32-bit
+// code.
+#ifndef __x86_64__
+int
+mon_kexec(int argc, char **argv, struct Trapframe *tf)
+{
+  char *p;
+  long mod;
+  int r;
+
+  if (argc > 2) {
+    cprintf("Usage: kexec [module]\n");
+    return 0;
+  }
+  if (argc == 1)
+    r = kexec_disk();
+  else {
+    mod = strtol(argv[1], &p, 0);
+    if (*p) {
+      cprintf("kexec: bad module number '%s'\n", argv[1]);
+      return 0;
+    }
+    r = kexec_module(mod);
+  }
+  // only get here if it failed
+  cprintf("kexec: %e\n", r);
+  return 0;
+}
+#endif
+
+// Emit the boot timeline as one line on the serial port for scripts:
+// "BOOTTIME khz=K start=T name=C ...", where T is the TSC at boot.S
+// start and each C counts cycles since then.
+static void
+boottime_report(void)
+{
+  struct Bootinfo *bi = bootinfo;
+  struct Bootstamp *bs;
+  char buf[48], label[16];
+  int i;
+
+  if (!bi || bi->bi_nstamp == 0)
+    return;
+  snprintf(buf, sizeof(buf), "BOOTTIME khz=%u", tsc_khz());
+  serial_puts(buf);
+  for (i = 0; i < bi->bi_nstamp && i < BI_NSTAMP; i++) {
+    bs = &bi->bi_stamps[i];
+    bt_label(bs, label, sizeof(label));
+    snprintf(buf, sizeof(buf), " %s=%llu", label,
+             i == 0 ? bs->bs_tsc : bs->bs_tsc - bi->bi_stamps[0].bs_tsc);
+    serial_puts(buf);
+  }
+  serial_puts("\n");
+}
+
+#ifndef __x86_64__
+int
+mon_hibernate(int argc, char **argv, struct Trapframe *tf)
+{
+  int r;
+
+  if (argc == 2 && strcmp(argv[1], "-d") == 0) {
+    if ((r = hibernate_discard()) < 0)
+      cprintf("hibernate: %e\n", r);
+    return 0;
+  }
+  if (argc != 1) {
+    cprintf("Usage: hibernate [-d]\n");
+    return 0;
+  }
+
+  if ((r = hibernate()) < 0) {
+    cprintf("hibernate: %e\n", r);
+    return 0;
+  }
+  if (r == 0) {
+    cprintf("Hibernated; it is now safe to turn off the machine.\n");
+    while (1)
+      /* do nothing */ ;
+  }
+  // resumed
+  cprintf("Resumed from hibernation\n");
+  boot_stamp(BT_MONITOR, 0);
+  boottime_report();
+  return 0;
+}
+#endif
+
 /***** Kernel monitor command interpreter *****/
 
 #define WHITESPACE "\t\r\n "
@@ -137,11 +428,18 @@ runcmd(char *buf, struct Trapframe *tf)
 void
 monitor(struct Trapframe *tf)
 {
+  static bool booted;
   char *buf;
 
   cprintf("Welcome to the JOS kernel monitor!\n");
   cprintf("Type 'help' for a list of commands.\n");
 
+  if (!booted) {
+    booted = 1;
+    boot_stamp(BT_MONITOR, 0);
+    boottime_report();
+  }
+
   while (1) {
     buf = readline("K> ");
     if (buf != NULL)
@@ -153,10 +451,8 @@ monitor(struct Trapframe *tf)
 // return EIP of caller.
 // does not work if inlined.
 // putting at the end of the file seems to prevent inlining.
-unsigned
-read_eip()
+uintptr_t
+read_eip(void)
 {
-  uint32_t callerpc;
-  __asm __volatile("movl 4(%%ebp), %0":"=r"(callerpc));
-  return callerpc;
+  return (uintptr_t) __builtin_return_address(0);
 }
@@ -0,0 +1,1512 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/hibernate.h>
+
+#include <kern/pmap.h>
+#include <kern/bootinfo.h>
+
+// These variables are set by i386_detect_memory()
+size_t npages;			// Amount of physical memory (in pages)
+size_t npages_lowmem;		// Pages mapped at KERNBASE
+static size_t npages_basemem;	// Amount of base memory (in pages)
+
+// The early page directories (kern/entrypgdir.c, or
+// kern/entrypgdir64.c for x86-64)
+#ifdef __x86_64__
+extern pae_pde_t entry_kpd[];
+#else
+extern pde_t entry_pgdir[];
+extern pae_pde_t entry_pae_pd[][PAE_NPDENTRIES];
+#endif
+
+uint64_t boot_nx;		// PTE_NX if no-execute is enabled, else 0
+
+// These variables are set by page_init()
+struct Page *pages;		// Physical page state array
+static bool pages_ready;	// page_init() is done
+ppn_t page_kern_end;		// End of the kernel and boot_alloc() memory
+struct PageZone page_zones[NZONES] = {
+  [ZONE_LOWMEM] = { "lowmem" },
+  [ZONE_HIGHMEM] = { "highmem" },
+};
+struct PageMag page_mags[NCPU];	// Per-CPU free page magazines
+struct PageZeroPool page_zero_pool;	// Free pages known to be zero
+
+
+// --------------------------------------------------------------
+// Detect machine's physical memory setup.
+// --------------------------------------------------------------
+
+static const char *const e820_names[] = {
+  [E820_RAM] = "usable",
+  [E820_RESERVED] = "reserved",
+  [E820_ACPI] = "ACPI data",
+  [E820_NVS] = "ACPI NVS",
+  [E820_BAD] = "unusable",
+};
+
+// Read a 16-bit value from the CMOS NVRAM, low byte at register 'r'.
+static int
+nvram_read(int r)
+{
+  int lo, hi;
+
+  outb(0x70, r);
+  lo = inb(0x71);
+  outb(0x70, r + 1);
+  hi = inb(0x71);
+  return lo | (hi << 8);
+}
+
+static void boot_map_memory(void);
+static void kmap_init(void);
+
+// Size memory from the E820 map the boot loader handed us, or
+// from the CMOS if there is none.  Without PAE only RAM below 4GB
+// counts.  With PAE, RAM up to 64GB counts; pages past 4GB have page
+// numbers below npages, but no (32-bit) physaddr_t, so they can only
+// be reached through page table mappings.
+void
+i386_detect_memory(void)
+{
+  struct Bootinfo *bi = bootinfo;
+  struct E820ent *e;
+  uint64_t top, maxtop, maxphys;
+  size_t basemem, extmem;
+  int i;
+
+  maxphys = paging_pae ? 0x1000000000ULL : 0x100000000ULL;
+  maxtop = 0;
+  basemem = 0;
+  if (bi && bi->bi_ne820 > 0) {
+    for (i = 0; i < bi->bi_ne820 && i < BI_NE820; i++) {
+      e = &bi->bi_e820[i];
+      cprintf("  e820: [%016llx, %016llx) %s\n", e->addr, e->addr + e->len,
+              e->type < sizeof(e820_names) / sizeof(e820_names[0])
+              && e820_names[e->type] ? e820_names[e->type] : "?");
+      if (e->type != E820_RAM)
+        continue;
+      top = e->addr + e->len;
+      if (top > maxphys)
+        top = maxphys;
+      if (e->addr == 0)
+        basemem = MIN(top, (uint64_t) IOPHYSMEM);
+      if (top > maxtop)
+        maxtop = top;
+    }
+    npages_basemem = basemem / PGSIZE;
+    npages = maxtop / PGSIZE;
+  } else {
+    // Base memory and extended memory sizes in KB, from the CMOS
+    npages_basemem = (nvram_read(0x15) * 1024) / PGSIZE;
+    extmem = (nvram_read(0x17) * 1024) / PGSIZE;
+    if (extmem)
+      npages = (EXTPHYSMEM / PGSIZE) + extmem;
+    else
+      npages = npages_basemem;
+  }
+
+  cprintf("Physical memory: %uK available, base = %uK, extended = %uK\n",
+          npages * (PGSIZE / 1024),
+          npages_basemem * (PGSIZE / 1024),
+          npages > EXTPHYSMEM / PGSIZE
+          ? (npages - EXTPHYSMEM / PGSIZE) * (PGSIZE / 1024) : 0);
+
+  boot_map_memory();
+}
+
+// The page directory entry for kernel virtual address 'va', in
+// whichever page directory entry.S loaded, widened to 64 bits.
+static uint64_t
+kern_pde_get(uintptr_t va)
+{
+  assert(va >= KERNBASE);
+#ifdef __x86_64__
+  return entry_kpd[(va - KERNBASE) / PAE_PTSIZE];
+#else
+  if (paging_pae)
+    return entry_pae_pd[1][PAE_PDX(va)];
+  return entry_pgdir[PDX(va)];
+#endif
+}
+
+// Set that entry.  Without PAE the upper 32 bits of 'pde', such as
+// PTE_NX, are dropped.
+static void
+kern_pde_set(uintptr_t va, uint64_t pde)
+{
+  assert(va >= KERNBASE);
+#ifdef __x86_64__
+  entry_kpd[(va - KERNBASE) / PAE_PTSIZE] = pde;
+#else
+  if (paging_pae)
+    entry_pae_pd[1][PAE_PDX(va)] = pde;
+  else
+    entry_pgdir[PDX(va)] = (pde_t) pde;
+#endif
+}
+
+// Map the large page (LPGSIZE bytes) at kernel virtual address 'va'
+// to physical address 'pa'.  'perm' may include PTE_NX, which only
+// means something with PAE.
+static void
+boot_map_large(uintptr_t va, physaddr_t pa, uint64_t perm)
+{
+  assert(va % LPGSIZE == 0);
+  kern_pde_set(va, pa | perm | PTE_PS);
+}
+
+// entry.S only mapped what the kernel image needed.  Map the rest of
+// RAM at KERNBASE too, with global large pages, as far as VMALLOCBASE
+// (188MB, or 1.5GB for x86-64); RAM past that is highmem.
+// No code runs from there, so with PAE (or long mode) and a CPU that
+// has it, make it no-execute.  The new entries were not present
+// before, so there is nothing to flush from the TLB.
+static void
+boot_map_memory(void)
+{
+  uint32_t eax, edx;
+  uint64_t top;
+
+  if (paging_pae) {
+    cpuid(0x80000000, &eax, NULL, NULL, NULL);
+    if (eax >= 0x80000001) {
+      cpuid(0x80000001, NULL, NULL, NULL, &edx);
+      if (edx & CPUID_NX) {
+        wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+        boot_nx = PTE_NX;
+      }
+    }
+  }
+
+  top = MIN((uint64_t) npages * PGSIZE, (uint64_t) (VMALLOCBASE - KERNBASE));
+  for (; boot_mapped < top; boot_mapped += LPGSIZE)
+    boot_map_large(KERNBASE + boot_mapped, boot_mapped,
+                   PTE_P | PTE_W | PTE_G | boot_nx);
+  npages_lowmem = MIN(npages, (size_t) (boot_mapped / PGSIZE));
+  if (npages > npages_lowmem)
+    cprintf("Highmem: %uK above the direct map\n",
+            (npages - npages_lowmem) * (PGSIZE / 1024));
+
+  kmap_init();
+}
+
+
+// --------------------------------------------------------------
+// Highmem: temporary mappings of pages outside the direct map.
+// --------------------------------------------------------------
+
+// The page table behind the kmap slots, in the current paging mode's
+// format.  With one CPU, one set of slots will do; with more, each CPU
+// would get its own range of them.
+#ifndef __x86_64__
+__attribute__ ((__aligned__(PGSIZE)))
+static pte_t kmap_pgtable[NPTENTRIES];
+#endif
+__attribute__ ((__aligned__(PGSIZE)))
+static pae_pte_t kmap_pae_pgtable[PAE_NPTENTRIES];
+
+static uint32_t kmap_busy;	// bitmap of slots in use
+
+static void
+kmap_init(void)
+{
+#ifndef __x86_64__
+  if (!paging_pae) {
+    kern_pde_set(KMAPBASE, PADDR(kmap_pgtable) | PTE_P | PTE_W);
+    return;
+  }
+#endif
+  kern_pde_set(KMAPBASE, PADDR(kmap_pae_pgtable) | PTE_P | PTE_W);
+}
+
+static void
+kmap_set(int slot, uint64_t pte)
+{
+#ifndef __x86_64__
+  if (!paging_pae) {
+    kmap_pgtable[slot] = pte;
+    return;
+  }
+#endif
+  kmap_pae_pgtable[slot] = pte;
+}
+
+// Return a kernel virtual address for physical page number 'ppn'
+// (a page number, since with PAE the page may lie above 4GB).  Pages
+// in the direct map are simply there; others take a kmap slot until
+// kunmap().
+void *
+kmap(ppn_t ppn)
+{
+  int i;
+
+  if (ppn < npages_lowmem)
+    return KADDR((physaddr_t) ppn << PGSHIFT);
+  assert(ppn < npages);
+  for (i = 0; i < KMAP_NSLOTS; i++)
+    if (!(kmap_busy & (1U << i)))
+      break;
+  if (i == KMAP_NSLOTS)
+    panic("kmap: out of slots");
+  kmap_busy |= 1U << i;
+  // The slot was not present, so there is nothing to flush.
+  kmap_set(i, (uint64_t) ppn << PGSHIFT | PTE_P | PTE_W | boot_nx);
+  return (void *) (KMAPBASE + i * PGSIZE);
+}
+
+// Release the address 'va' returned by kmap().
+void
+kunmap(void *va)
+{
+  int i;
+
+  if ((uintptr_t) va < KMAPBASE)
+    return;
+  i = ((uintptr_t) va - KMAPBASE) / PGSIZE;
+  assert(i < KMAP_NSLOTS && (kmap_busy & (1U << i)));
+  kmap_set(i, 0);
+  invlpg(va);
+  kmap_busy &= ~(1U << i);
+}
+
+
+// --------------------------------------------------------------
+// Physical page allocator.
+// --------------------------------------------------------------
+
+// This simple physical memory allocator is used only while JOS is
+// setting up its memory system.  page_alloc() is the real allocator.
+//
+// If n>0, allocates enough pages of contiguous physical memory to hold
+// 'n' bytes, from the direct map.  Doesn't initialize the memory.
+// Returns a kernel virtual address.
+//
+// If n==0, returns the address of the next free page without allocating
+// anything.
+static void *
+boot_alloc(size_t n)
+{
+  extern char end[];
+  static char *nextfree;	// virtual address of next byte of free memory
+  char *result;
+  physaddr_t limit;
+
+  if (pages_ready)
+    panic("boot_alloc: called after page_init");
+  if (!nextfree)
+    nextfree = ROUNDUP((char *) end, PGSIZE);
+  result = nextfree;
+  // Before i386_detect_memory(), all we know is what entry.S mapped.
+  limit = npages_lowmem ? npages_lowmem * PGSIZE : boot_mapped;
+  if (PADDR(nextfree) > limit || n > limit - PADDR(nextfree))
+    panic("boot_alloc: out of memory");
+  nextfree = ROUNDUP(nextfree + n, PGSIZE);
+  return result;
+}
+
+// All boot arenas, released or not
+static LIST_HEAD(BootArena_list, BootArena) boot_arenas;
+
+// Set up 'ba' as an arena of 'size' bytes (rounded up to whole pages).
+// Before page_init() the pages come from boot_alloc() (and so, before
+// i386_detect_memory(), from what entry.S mapped), after it from the
+// page allocator.
+void
+boot_arena_init(struct BootArena *ba, const char *name, size_t size)
+{
+  struct Page *pp;
+
+  size = ROUNDUP(size, PGSIZE);
+  memset(ba, 0, sizeof(*ba));
+  ba->ba_name = name;
+  if (!pages_ready)
+    ba->ba_start = boot_alloc(size);
+  else if ((pp = page_alloc_contig(size / PGSIZE, 1, 0)))
+    ba->ba_start = page2kva(pp);
+  else
+    panic("boot_arena_init: no memory for %s", name);
+  ba->ba_next = ba->ba_start;
+  ba->ba_end = ba->ba_start + size;
+  LIST_INSERT_HEAD(&boot_arenas, ba, ba_link);
+}
+
+// Allocate 'n' bytes from arena 'ba', aligned to 'align' (a power of
+// two).  If 'color', successive allocations are also offset by 0, 1,
+// ... BOOT_NCOLORS-1 cache lines (or multiples of 'align', if larger),
+// so that equally aligned structures don't all compete for the same
+// cache sets.  Doesn't initialize the memory.  Panics if the arena is
+// full.
+void *
+boot_arena_alloc(struct BootArena *ba, size_t n, size_t align, bool color)
+{
+  char *result;
+  size_t step;
+
+  assert(!ba->ba_released && align > 0 && (align & (align - 1)) == 0);
+  result = ROUNDUP(ba->ba_next, align);
+  if (color) {
+    step = MAX(align, (size_t) CACHELINE);
+    result = ROUNDUP(result, step) + (ba->ba_color++ % BOOT_NCOLORS) * step;
+  }
+  if (result > ba->ba_end || n > (size_t) (ba->ba_end - result))
+    panic("boot_arena_alloc: %s is full", ba->ba_name);
+  ba->ba_next = result + n;
+  return result;
+}
+
+// Give all of arena 'ba' back at once: to the page allocator if it is
+// running, or else to page_init(), which will leave it free.  Nothing
+// allocated from the arena may be used afterwards.
+void
+boot_arena_release(struct BootArena *ba)
+{
+  struct Page *pp;
+  size_t i, n;
+
+  assert(!ba->ba_released);
+  ba->ba_released = 1;
+  if (!pages_ready)
+    return;
+  // Pages boot_alloc() gave the arena are still marked as kept back.
+  pp = pa2page(PADDR(ba->ba_start));
+  n = (ba->ba_end - ba->ba_start) / PGSIZE;
+  for (i = 0; i < n; i++)
+    if (pp[i].pp_order == PAGE_RESERVED)
+      pp[i].pp_order = PAGE_NOTFREE;
+  page_free_contig(pp, n);
+}
+
+// The free page bitmap: bit i is set iff page i is in a free block on
+// the buddy allocator's lists.  It answers questions about runs of
+// free pages a word (32 or 64 pages) at a time, without touching
+// struct Page.
+#define PFM_BITS	(8 * sizeof(uintptr_t))
+
+static uintptr_t *page_free_map;
+
+static bool
+pfm_test(size_t i)
+{
+  return (page_free_map[i / PFM_BITS] >> (i % PFM_BITS)) & 1;
+}
+
+// Mark pages [start, end) free or not.
+static void
+pfm_update(size_t start, size_t end, bool free)
+{
+  uintptr_t mask;
+  size_t i, base;
+
+  for (i = start; i < end; i = base + PFM_BITS) {
+    base = ROUNDDOWN(i, PFM_BITS);
+    mask = ~(uintptr_t) 0 << (i - base);
+    if (end - base < PFM_BITS)
+      mask &= ((uintptr_t) 1 << (end - base)) - 1;
+    if (free)
+      page_free_map[i / PFM_BITS] |= mask;
+    else
+      page_free_map[i / PFM_BITS] &= ~mask;
+  }
+}
+
+// Return the first page in [i, end) that is free (if 'free') or not,
+// or 'end' if there is none.  Skips whole words at a time.
+static size_t
+pfm_find(size_t i, size_t end, bool free)
+{
+  uintptr_t w;
+  size_t base;
+
+  for (; i < end; i = base + PFM_BITS) {
+    base = ROUNDDOWN(i, PFM_BITS);
+    w = page_free_map[i / PFM_BITS];
+    if (!free)
+      w = ~w;
+    w &= ~(uintptr_t) 0 << (i - base);
+    if (w)
+      return MIN(base + __builtin_ctzl(w), end);
+  }
+  return end;
+}
+
+static struct PageZone *
+page_zone(ppn_t ppn)
+{
+  return &page_zones[ppn < npages_lowmem ? ZONE_LOWMEM : ZONE_HIGHMEM];
+}
+
+// Put the block of 1 << order pages at 'ppn' on its zone's free lists,
+// merging it with its buddy, the other half of the block one order up,
+// for as long as the buddy is free too.
+static void
+buddy_free(ppn_t ppn, int order)
+{
+  struct PageZone *z = page_zone(ppn);
+  ppn_t buddy;
+
+  pages[ppn].pp_order = PAGE_NOTFREE;
+  pfm_update(ppn, ppn + (1 << order), 1);
+  for (; order < PAGE_NORDER - 1; order++) {
+    buddy = ppn ^ (1 << order);
+    if (buddy < z->pz_start || buddy >= z->pz_end || !pfm_test(buddy)
+        || pages[buddy].pp_order != order)
+      break;
+    LIST_REMOVE(&pages[buddy], pp_link);
+    pages[buddy].pp_order = PAGE_NOTFREE;
+    z->pz_nfree[order]--;
+    ppn &= ~(1 << order);
+  }
+  pages[ppn].pp_order = order;
+  LIST_INSERT_HEAD(&z->pz_free[order], &pages[ppn], pp_link);
+  z->pz_nfree[order]++;
+}
+
+// Take a block of 1 << order pages from zone 'z': the first block on
+// the smallest non-empty list at or above 'order', halved as many
+// times as needed, with the unused upper halves going back on the
+// lists.  Returns NULL if there is none.
+static struct Page *
+buddy_alloc(struct PageZone *z, int order)
+{
+  struct Page *pp, *half;
+  int o;
+
+  for (o = order; o < PAGE_NORDER; o++)
+    if (!LIST_EMPTY(&z->pz_free[o]))
+      break;
+  if (o == PAGE_NORDER)
+    return NULL;
+
+  pp = LIST_FIRST(&z->pz_free[o]);
+  LIST_REMOVE(pp, pp_link);
+  pp->pp_order = PAGE_NOTFREE;
+  z->pz_nfree[o]--;
+  while (o > order) {
+    o--;
+    half = pp + (1 << o);
+    half->pp_order = o;
+    LIST_INSERT_HEAD(&z->pz_free[o], half, pp_link);
+    z->pz_nfree[o]++;
+  }
+  pfm_update(page2ppn(pp), page2ppn(pp) + (1 << order), 0);
+  return pp;
+}
+
+// Free pages [start, end) as the largest aligned blocks that fit.
+static void
+buddy_free_range(ppn_t start, ppn_t end)
+{
+  int order;
+
+  while (start < end) {
+    for (order = PAGE_NORDER - 1; order > 0; order--)
+      if (start % (1 << order) == 0 && start + (1 << order) <= end)
+        break;
+    buddy_free(start, order);
+    start += 1 << order;
+  }
+}
+
+// Take the free pages [start, end) off the free lists.  Each free
+// block they fall in is removed whole, and the parts of it outside
+// [start, end) are freed again.
+static void
+buddy_take_range(ppn_t start, ppn_t end)
+{
+  struct PageZone *z = page_zone(start);
+  ppn_t ppn, head;
+  int order;
+
+  for (ppn = start; ppn < end; ppn = head + (1 << order)) {
+    // The block holding ppn is the one whose head's pp_order matches
+    // the alignment it was found at.
+    for (order = 0; order < PAGE_NORDER; order++) {
+      head = ppn & ~((1 << order) - 1);
+      if (pages[head].pp_order == order)
+        break;
+    }
+    assert(order < PAGE_NORDER);
+    LIST_REMOVE(&pages[head], pp_link);
+    pages[head].pp_order = PAGE_NOTFREE;
+    z->pz_nfree[order]--;
+    pfm_update(head, head + (1 << order), 0);
+    buddy_free_range(head, MAX(head, start));
+    buddy_free_range(MIN(end, head + (1 << order)), head + (1 << order));
+  }
+}
+
+// Find 'n' free pages in a row in zone 'z', at or above page 'from',
+// starting at a multiple of 'align' pages (a power of two).  Returns
+// the first page number, or z->pz_end if there is no such run.
+static size_t
+pfm_find_run(struct PageZone *z, size_t from, size_t n, size_t align)
+{
+  size_t start, stop;
+
+  for (start = MAX(from, z->pz_start); ; start = stop + 1) {
+    start = ROUNDUP(pfm_find(start, z->pz_end, 1), align);
+    if (start + n > z->pz_end)
+      return z->pz_end;
+    if ((stop = pfm_find(start, start + n, 0)) == start + n)
+      return start;
+  }
+}
+
+// The longest run of free pages on zone z's free lists, for buddyinfo.
+size_t
+page_free_run_max(struct PageZone *z)
+{
+  size_t start, stop, max;
+
+  max = 0;
+  for (start = z->pz_start; start < z->pz_end; start = stop) {
+    start = pfm_find(start, z->pz_end, 1);
+    stop = pfm_find(start, z->pz_end, 0);
+    max = MAX(max, stop - start);
+  }
+  return max;
+}
+
+// Is physical page 'ppn' in use before the allocator starts, or kept
+// for the boot loader?  That is: the real-mode IDT and BIOS data in
+// page 0, the Bootinfo block, the boot loader and its hibernation
+// scratch space, the kernel and what boot_alloc() handed out (less any
+// boot arenas already released), and any boot modules.
+static bool
+page_reserved(ppn_t ppn, ppn_t kern_end)
+{
+  struct BootArena *ba;
+  int i;
+
+  LIST_FOREACH(ba, &boot_arenas, ba_link)
+    if (ba->ba_released && ppn >= PPN(PADDR(ba->ba_start))
+        && ppn < PPN(PADDR(ba->ba_end)))
+      return 0;
+  if (ppn == 0)
+    return 1;
+  if (ppn >= BOOTINFO / PGSIZE
+      && ppn < ROUNDUP(BOOTINFO + sizeof(struct Bootinfo), PGSIZE) / PGSIZE)
+    return 1;
+  if (ppn >= BOOTLOADER / PGSIZE
+      && ppn < ROUNDUP(BOOTLOADER_END, PGSIZE) / PGSIZE)
+    return 1;
+  if (ppn >= HIB_SCRATCH / PGSIZE
+      && ppn < ROUNDUP(HIB_SCRATCH_END, PGSIZE) / PGSIZE)
+    return 1;
+  if (ppn >= EXTPHYSMEM / PGSIZE && ppn < kern_end)
+    return 1;
+  for (i = 0; bootinfo && i < bootinfo->bi_nmods && i < BI_NMODS; i++)
+    if (ppn >= bootinfo->bi_mods[i].start / PGSIZE
+        && ppn < ROUNDUP(bootinfo->bi_mods[i].end, PGSIZE) / PGSIZE)
+      return 1;
+  return 0;
+}
+
+// Set up 'pages' and put all free RAM on the buddy allocator's free
+// lists.  After this, boot_alloc() must not be used; boot arenas come
+// from the page allocator instead.
+void
+page_init(void)
+{
+  struct Bootinfo *bi = bootinfo;
+  struct E820ent *e;
+  size_t maxpages, i;
+  uint64_t start, end;
+  ppn_t kern_end, ppn;
+
+  // Keep the Page array to a quarter of the direct map; RAM past what
+  // that covers goes unused.
+  maxpages = npages_lowmem * PGSIZE / 4 / sizeof(struct Page);
+  if (npages > maxpages) {
+    cprintf("Page array: using only the first %luK of RAM\n",
+            maxpages * (PGSIZE / 1024));
+    npages = maxpages;
+  }
+  pages = boot_alloc(npages * sizeof(struct Page));
+  memset(pages, 0, npages * sizeof(struct Page));
+  page_free_map = boot_alloc(ROUNDUP(npages, PFM_BITS) / 8);
+  memset(page_free_map, 0, ROUNDUP(npages, PFM_BITS) / 8);
+  for (i = 0; i < npages; i++)
+    pages[i].pp_order = PAGE_RESERVED;
+
+  page_zones[ZONE_LOWMEM].pz_start = 0;
+  page_zones[ZONE_LOWMEM].pz_end = npages_lowmem;
+  page_zones[ZONE_HIGHMEM].pz_start = npages_lowmem;
+  page_zones[ZONE_HIGHMEM].pz_end = npages;
+
+  // Free RAM a page at a time; buddy_free() merges the pages into
+  // blocks as it goes.  E820 entries may overlap, so skip pages that
+  // are free already.
+  kern_end = page_kern_end = PPN(PADDR(boot_alloc(0)));
+  if (bi && bi->bi_ne820 > 0) {
+    for (i = 0; i < bi->bi_ne820 && i < BI_NE820; i++) {
+      e = &bi->bi_e820[i];
+      if (e->type != E820_RAM)
+        continue;
+      start = (e->addr + PGSIZE - 1) / PGSIZE;
+      end = MIN((e->addr + e->len) / PGSIZE, (uint64_t) npages);
+      for (ppn = start; ppn < end; ppn++)
+        if (!page_reserved(ppn, kern_end) && !pfm_test(ppn))
+          buddy_free(ppn, 0);
+    }
+  } else {
+    for (ppn = 0; ppn < npages; ppn++)
+      if ((ppn < npages_basemem || ppn >= EXTPHYSMEM / PGSIZE)
+          && !page_reserved(ppn, kern_end))
+        buddy_free(ppn, 0);
+  }
+  pages_ready = 1;
+}
+
+// Refill magazine 'pm' with PAGEMAG_BATCH pages from the lowmem zone,
+// in one block if there is one that big, else as many single pages as
+// are left.
+static void
+pagemag_refill(struct PageMag *pm)
+{
+  struct PageZone *z = &page_zones[ZONE_LOWMEM];
+  struct Page *pp;
+  int i;
+
+  pm->pm_refill++;
+  if ((pp = buddy_alloc(z, PAGEMAG_BATCH_ORDER))) {
+    // Push the block backwards, so its first page comes out first.
+    for (i = PAGEMAG_BATCH - 1; i >= 0; i--) {
+      pp[i].pp_order = PAGE_MAGAZINE;
+      pm->pm_pages[pm->pm_count++] = pp + i;
+    }
+    return;
+  }
+  for (i = 0; i < PAGEMAG_BATCH; i++) {
+    if (!(pp = buddy_alloc(z, 0)))
+      break;
+    pp->pp_order = PAGE_MAGAZINE;
+    pm->pm_pages[pm->pm_count++] = pp;
+  }
+}
+
+// Return the PAGEMAG_BATCH pages at the bottom of magazine 'pm',
+// those freed longest ago and so least likely to be in the cache, to
+// the buddy allocator.
+static void
+pagemag_drain(struct PageMag *pm)
+{
+  int i;
+
+  pm->pm_drain++;
+  for (i = 0; i < PAGEMAG_BATCH; i++)
+    buddy_free(page2ppn(pm->pm_pages[i]), 0);
+  pm->pm_count -= PAGEMAG_BATCH;
+  memmove(pm->pm_pages, pm->pm_pages + PAGEMAG_BATCH,
+          pm->pm_count * sizeof(pm->pm_pages[0]));
+}
+
+// Give the pre-zeroed pages and this CPU's magazine back to the buddy
+// allocator, when memory is too short to keep them aside: they may
+// complete a larger block or run.  Returns the number of pages freed.
+static size_t
+page_cache_release(void)
+{
+  struct PageMag *pm = &page_mags[cpunum()];
+  struct Page *pp;
+  size_t n;
+
+  n = 0;
+  while ((pp = LIST_FIRST(&page_zero_pool.zp_pages))) {
+    LIST_REMOVE(pp, pp_link);
+    page_zero_pool.zp_count--;
+    buddy_free(page2ppn(pp), 0);
+    n++;
+  }
+  while (pm->pm_count > 0) {
+    buddy_free(page2ppn(pm->pm_pages[--pm->pm_count]), 0);
+    n++;
+  }
+  return n;
+}
+
+// Zero one free page for the pre-zeroed pool, if the pool is short.
+// Called while the kernel is idle: each call does one page's worth of
+// work at most, so the caller can check for real work between calls.
+// Returns 1 if it zeroed a page, 0 if there was nothing to do.
+int
+page_scrub(void)
+{
+  struct PageZeroPool *zp = &page_zero_pool;
+  struct Page *pp;
+
+  if (!pages || zp->zp_count >= PAGE_ZERO_TARGET)
+    return 0;
+  if (!(pp = buddy_alloc(&page_zones[ZONE_LOWMEM], 0)))
+    return 0;
+  memset(page2kva(pp), 0, PGSIZE);
+  pp->pp_order = PAGE_ZEROPOOL;
+  LIST_INSERT_HEAD(&zp->zp_pages, pp, pp_link);
+  zp->zp_count++;
+  zp->zp_scrubbed++;
+  return 1;
+}
+
+// Allocate a block of 1 << order physically contiguous pages, aligned
+// to its size.  With ALLOC_HIGHMEM the pages may lie above the direct
+// map, and are taken from there first, to leave lowmem to those who
+// need it.  With ALLOC_ZERO the pages are zero-filled; single pages
+// come ready-zeroed from the pool page_scrub() fills, if it has any.
+// Other single lowmem pages come from this CPU's magazine.
+//
+// Does NOT increment pp_ref: the caller must do that if necessary.
+//
+// Returns NULL if out of free memory.
+struct Page *
+page_alloc_order(int order, int alloc_flags)
+{
+  struct PageZeroPool *zp = &page_zero_pool;
+  struct PageMag *pm;
+  struct Page *pp;
+  void *va;
+  int i;
+
+  assert(order >= 0 && order < PAGE_NORDER);
+  if (order == 0 && (alloc_flags & ALLOC_ZERO)
+      && (pp = LIST_FIRST(&zp->zp_pages))) {
+    LIST_REMOVE(pp, pp_link);
+    pp->pp_order = PAGE_NOTFREE;
+    zp->zp_count--;
+    zp->zp_hit++;
+    return pp;
+  }
+
+  pp = NULL;
+  if (alloc_flags & ALLOC_HIGHMEM)
+    pp = buddy_alloc(&page_zones[ZONE_HIGHMEM], order);
+  if (!pp && order == 0) {
+    pm = &page_mags[cpunum()];
+    pm->pm_alloc++;
+    if (pm->pm_count > 0)
+      pm->pm_alloc_hit++;
+    else
+      pagemag_refill(pm);
+    if (pm->pm_count > 0) {
+      pp = pm->pm_pages[--pm->pm_count];
+      pp->pp_order = PAGE_NOTFREE;
+    }
+  }
+  if (!pp && order > 0)
+    pp = buddy_alloc(&page_zones[ZONE_LOWMEM], order);
+  if (!pp && page_cache_release() > 0)
+    pp = buddy_alloc(&page_zones[ZONE_LOWMEM], order);
+  if (!pp)
+    return NULL;
+
+  if (alloc_flags & ALLOC_ZERO) {
+    if (order == 0)
+      zp->zp_miss++;
+    for (i = 0; i < (1 << order); i++) {
+      va = kmap(page2ppn(pp + i));
+      memset(va, 0, PGSIZE);
+      kunmap(va);
+    }
+  }
+  return pp;
+}
+
+// Allocate 'n' physically contiguous pages, starting at a multiple of
+// 'align' pages (a power of two), for when a power-of-two block from
+// page_alloc_order() would waste too much.  'alloc_flags' is as for
+// page_alloc_order().  The pages are found by scanning the free page
+// bitmap, and freed with page_free_contig().
+//
+// Returns NULL if there is no such run of free pages.
+struct Page *
+page_alloc_contig(size_t n, size_t align, int alloc_flags)
+{
+  struct PageZone *z;
+  size_t start, i;
+  void *va;
+  int retry;
+
+  assert(n > 0 && align > 0 && (align & (align - 1)) == 0);
+  for (retry = 0; retry < 2; retry++) {
+    start = npages;
+    if (alloc_flags & ALLOC_HIGHMEM) {
+      z = &page_zones[ZONE_HIGHMEM];
+      if ((start = pfm_find_run(z, z->pz_start, n, align)) == z->pz_end)
+        start = npages;
+    }
+    if (start == npages) {
+      z = &page_zones[ZONE_LOWMEM];
+      if ((start = pfm_find_run(z, z->pz_start, n, align)) == z->pz_end)
+        start = npages;
+    }
+    if (start < npages)
+      break;
+    if (page_cache_release() == 0)
+      break;
+  }
+  if (start == npages)
+    return NULL;
+
+  buddy_take_range(start, start + n);
+  if (alloc_flags & ALLOC_ZERO)
+    for (i = start; i < start + n; i++) {
+      va = kmap(i);
+      memset(va, 0, PGSIZE);
+      kunmap(va);
+    }
+  return &pages[start];
+}
+
+// Allocate 'n' contiguous lowmem pages, not zeroed, starting at or
+// above page 'min', for memory that must stay clear of the pages below
+// (kexec stages a new kernel above its load addresses).  Free them with
+// page_free_contig().
+//
+// Returns NULL if there is no such run of free pages.
+struct Page *
+page_alloc_contig_above(size_t n, ppn_t min)
+{
+  struct PageZone *z = &page_zones[ZONE_LOWMEM];
+  size_t start;
+
+  assert(n > 0);
+  start = pfm_find_run(z, min, n, 1);
+  if (start == z->pz_end && page_cache_release() > 0)
+    start = pfm_find_run(z, min, n, 1);
+  if (start == z->pz_end)
+    return NULL;
+  buddy_take_range(start, start + n);
+  return &pages[start];
+}
+
+// Free the 'n' pages at 'pp' from page_alloc_contig() or
+// page_alloc_contig_above().
+void
+page_free_contig(struct Page *pp, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    if (pp[i].pp_ref != 0 || pp[i].pp_order != PAGE_NOTFREE
+        || pfm_test(page2ppn(pp + i)))
+      panic("page_free_contig: page %08x is in use or already free",
+            page2ppn(pp + i));
+  buddy_free_range(page2ppn(pp), page2ppn(pp) + n);
+}
+
+// Allocate a single physical page (see page_alloc_order()).
+struct Page *
+page_alloc(int alloc_flags)
+{
+  return page_alloc_order(0, alloc_flags);
+}
+
+// Return the block of 1 << order pages at 'pp', from
+// page_alloc_order(), to the free lists, or a single lowmem page to
+// this CPU's magazine.
+// (This function should only be called when pp->pp_ref reaches 0.)
+void
+page_free_order(struct Page *pp, int order)
+{
+  struct PageMag *pm;
+
+  assert(order >= 0 && order < PAGE_NORDER);
+  assert(page2ppn(pp) % (1 << order) == 0);
+  // A free page is either on the free lists, and so marked in the
+  // bitmap, or cached, and so marked in pp_order.
+  if (pp->pp_ref != 0 || pp->pp_order != PAGE_NOTFREE
+      || pfm_test(page2ppn(pp)))
+    panic("page_free: page %08x is in use or already free", page2ppn(pp));
+  if (order > 0 || page2ppn(pp) >= npages_lowmem) {
+    buddy_free(page2ppn(pp), order);
+    return;
+  }
+
+  pm = &page_mags[cpunum()];
+  pm->pm_free++;
+  if (pm->pm_count < PAGEMAG_SIZE)
+    pm->pm_free_hit++;
+  else
+    pagemag_drain(pm);
+  pp->pp_order = PAGE_MAGAZINE;
+  pm->pm_pages[pm->pm_count++] = pp;
+}
+
+// Return a page to the free list.
+void
+page_free(struct Page *pp)
+{
+  page_free_order(pp, 0);
+}
+
+// Has page 'ppn' been handed out by the page allocator (as opposed to
+// free, cached in a magazine or the zero pool, or never managed)?
+bool
+page_allocated(ppn_t ppn)
+{
+  return pages[ppn].pp_order == PAGE_NOTFREE && !pfm_test(ppn);
+}
+
+// The number of bits set in 'x' (without libgcc's __popcount*).
+static int
+popcount32(uint32_t x)
+{
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0F0F0F0F;
+  return (x * 0x01010101) >> 24;
+}
+
+// Count the pages marked free in [start, end), a word at a time.
+static size_t
+pfm_count(size_t start, size_t end)
+{
+  uintptr_t w;
+  size_t i, base, n;
+
+  n = 0;
+  for (i = start; i < end; i = base + PFM_BITS) {
+    base = ROUNDDOWN(i, PFM_BITS);
+    w = page_free_map[i / PFM_BITS] & (~(uintptr_t) 0 << (i - base));
+    if (end - base < PFM_BITS)
+      w &= ((uintptr_t) 1 << (end - base)) - 1;
+    n += popcount32(w);
+    if (sizeof(w) > 4)
+      n += popcount32((uint64_t) w >> 32);
+  }
+  return n;
+}
+
+// Check that each zone's free lists agree with the free page bitmap:
+// every block is aligned, inside its zone, headed by a page carrying
+// its order, and marked free throughout, and the lists cover exactly
+// the pages the bitmap says are free.  Returns the number of free
+// pages on the lists.
+static size_t
+check_free_lists(void)
+{
+  struct PageZone *z;
+  struct Page *pp;
+  size_t total, nfree, nblocks;
+  ppn_t ppn;
+  int zi, o;
+
+  total = 0;
+  for (zi = 0; zi < NZONES; zi++) {
+    z = &page_zones[zi];
+    nfree = 0;
+    for (o = 0; o < PAGE_NORDER; o++) {
+      nblocks = 0;
+      LIST_FOREACH(pp, &z->pz_free[o], pp_link) {
+        ppn = page2ppn(pp);
+        assert(pp->pp_order == o);
+        assert(ppn % (1 << o) == 0);
+        assert(ppn >= z->pz_start && ppn + (1 << o) <= z->pz_end);
+        assert(pfm_find(ppn, ppn + (1 << o), 0) == ppn + (1 << o));
+        nblocks++;
+      }
+      assert(nblocks == z->pz_nfree[o]);
+      nfree += nblocks << o;
+    }
+    assert(pfm_count(z->pz_start, z->pz_end) == nfree);
+    total += nfree;
+  }
+  return total;
+}
+
+// Free pages outside the free lists, in magazines and the zero pool.
+static size_t
+page_ncached(void)
+{
+  size_t n;
+  int i;
+
+  n = page_zero_pool.zp_count;
+  for (i = 0; i < NCPU; i++)
+    n += page_mags[i].pm_count;
+  return n;
+}
+
+// The number of free pages by the allocator's own counts, cheaply:
+// those on the free lists, and those cached.
+static size_t
+page_nfree(void)
+{
+  size_t n;
+  int i, o;
+
+  n = page_ncached();
+  for (i = 0; i < NZONES; i++)
+    for (o = 0; o < PAGE_NORDER; o++)
+      n += page_zones[i].pz_nfree[o] << o;
+  return n;
+}
+
+// Check that the pages in [start, end) that page_init() had to keep
+// are neither free nor marked as ever having been.
+static void
+check_page_kept(ppn_t start, ppn_t end)
+{
+  ppn_t ppn;
+
+  for (ppn = start; ppn < MIN(end, (ppn_t) npages); ppn++)
+    if (page_reserved(ppn, page_kern_end))
+      assert(!pfm_test(ppn) && pages[ppn].pp_order == PAGE_RESERVED);
+}
+
+// Check buddy_take_range() and page_alloc_contig() on runs that are
+// not aligned and span several free blocks, in each zone: only the
+// pages asked for leave the free lists, and freeing them brings back
+// the same blocks.
+static void
+check_page_contig(void)
+{
+  size_t nfree[NZONES][PAGE_NORDER], total;
+  struct PageZone *z;
+  struct Page *pp;
+  ppn_t p;
+  int zi, i;
+
+  page_cache_release();
+  total = page_nfree();
+  for (zi = 0; zi < NZONES; zi++)
+    memmove(nfree[zi], page_zones[zi].pz_nfree, sizeof(nfree[zi]));
+
+  for (zi = 0; zi < NZONES; zi++) {
+    z = &page_zones[zi];
+    // Free all but the first page of a 32-page block, as blocks of
+    // orders 0 to 4 that the first page keeps from merging, then take
+    // a run from the middle of the order 1 block into the order 4 one.
+    if (!(pp = buddy_alloc(z, 5)))
+      continue;
+    p = page2ppn(pp);
+    buddy_free_range(p + 1, p + 32);
+    for (i = 0; i < 5; i++)
+      assert(pages[p + (1 << i)].pp_order == i);
+    assert(page_nfree() == total - 1);
+    buddy_take_range(p + 3, p + 20);
+    assert(page_nfree() == total - 18);
+    assert(pfm_find(p + 1, p + 3, 0) == p + 3);
+    assert(pfm_find(p + 3, p + 20, 1) == p + 20);
+    assert(pfm_find(p + 20, p + 32, 0) == p + 32);
+    buddy_free_range(p + 3, p + 20);
+    buddy_free(p, 0);
+    assert(page_nfree() == total);
+    assert(memcmp(nfree[zi], z->pz_nfree, sizeof(nfree[zi])) == 0);
+
+    // An odd-sized, aligned run through page_alloc_contig(), from this
+    // zone, which has room for it.
+    pp = page_alloc_contig(13, 4, zi == ZONE_HIGHMEM ? ALLOC_HIGHMEM : 0);
+    assert(pp);
+    p = page2ppn(pp);
+    assert(p % 4 == 0 && p >= z->pz_start && p + 13 <= z->pz_end);
+    assert(pfm_find(p, p + 13, 1) == p + 13);
+    for (i = 0; i < 13; i++)
+      assert(pp[i].pp_order == PAGE_NOTFREE);
+    assert(page_nfree() == total - 13);
+    page_free_contig(pp, 13);
+    assert(page_nfree() == total);
+    assert(memcmp(nfree[zi], z->pz_nfree, sizeof(nfree[zi])) == 0);
+  }
+}
+
+// Pages check_page_alloc() takes from the allocator at once.  Kept
+// small: the check runs on every boot.
+#define CHECK_NPAGES	256
+
+// Check the page allocator: that no page page_init() had to keep (page
+// 0, the Bootinfo block, the boot loader, the kernel and boot_alloc()
+// memory, boot modules) is free; allocate and free a block of every
+// order, directly from the buddy allocator and through
+// page_alloc_order(), checking that blocks split and merge back as
+// they should and that the free counts add up; and take a batch of
+// single pages at once.  The free lists are cross-checked against the
+// free page bitmap before and after, not at every step, to keep the
+// boot fast.
+void
+check_page_alloc(void)
+{
+  struct PageZone *z = &page_zones[ZONE_LOWMEM];
+  size_t nfree[PAGE_NORDER], total, n;
+  struct Page *pp, *pp0;
+  int i, o, j, k;
+
+  total = page_nfree();
+  assert(check_free_lists() + page_ncached() == total);
+
+  check_page_kept(0, 1);
+  check_page_kept(BOOTINFO / PGSIZE,
+                  ROUNDUP(BOOTINFO + sizeof(struct Bootinfo), PGSIZE) / PGSIZE);
+  check_page_kept(BOOTLOADER / PGSIZE,
+                  ROUNDUP(BOOTLOADER_END, PGSIZE) / PGSIZE);
+  check_page_kept(HIB_SCRATCH / PGSIZE,
+                  ROUNDUP(HIB_SCRATCH_END, PGSIZE) / PGSIZE);
+  check_page_kept(EXTPHYSMEM / PGSIZE, page_kern_end);
+  for (i = 0; bootinfo && i < bootinfo->bi_nmods && i < BI_NMODS; i++)
+    check_page_kept(bootinfo->bi_mods[i].start / PGSIZE,
+                    ROUNDUP(bootinfo->bi_mods[i].end, PGSIZE) / PGSIZE);
+
+  for (o = 0; o < PAGE_NORDER; o++) {
+    // buddy_alloc() splits the smallest block big enough, leaving one
+    // free block of each order in between, and buddy_free() merges
+    // them all back.
+    memmove(nfree, z->pz_nfree, sizeof(nfree));
+    for (j = o; j < PAGE_NORDER && nfree[j] == 0; j++)
+      ;
+    pp = buddy_alloc(z, o);
+    if (j == PAGE_NORDER) {
+      assert(!pp);
+      continue;
+    }
+    assert(pp && page2ppn(pp) % (1 << o) == 0);
+    assert(pfm_find(page2ppn(pp), page2ppn(pp) + (1 << o), 1)
+           == page2ppn(pp) + (1 << o));
+    for (k = 0; k < PAGE_NORDER; k++)
+      assert(z->pz_nfree[k] == nfree[k] - (k == j) + (k >= o && k < j));
+    assert(page_nfree() == total - (1 << o));
+    buddy_free(page2ppn(pp), o);
+    assert(memcmp(nfree, z->pz_nfree, sizeof(nfree)) == 0);
+
+    // The same through the public interface, magazines and all.
+    assert((pp = page_alloc_order(o, 0)));
+    assert(page2ppn(pp) % (1 << o) == 0 && pp->pp_order == PAGE_NOTFREE);
+    assert(page_nfree() == total - (1 << o));
+    page_free_order(pp, o);
+    assert(page_nfree() == total);
+  }
+
+  // Take a batch of pages, highmem first, chaining them through
+  // pp_link, then give them all back.
+  pp0 = NULL;
+  for (n = 0; n < CHECK_NPAGES && (pp = page_alloc(ALLOC_HIGHMEM)); n++) {
+    assert(!page_reserved(page2ppn(pp), page_kern_end));
+    assert(!pfm_test(page2ppn(pp)) && pp->pp_order == PAGE_NOTFREE);
+    LIST_NEXT(pp, pp_link) = pp0;
+    pp0 = pp;
+  }
+  assert(n == MIN(total, (size_t) CHECK_NPAGES));
+  assert(page_nfree() == total - n);
+  while ((pp = pp0)) {
+    pp0 = LIST_NEXT(pp, pp_link);
+    page_free(pp);
+  }
+  assert(page_nfree() == total);
+
+  check_page_contig();
+  assert(check_free_lists() + page_ncached() == total);
+
+  cprintf("check_page_alloc() succeeded!\n");
+}
+
+
+// --------------------------------------------------------------
+// vmalloc: virtually contiguous kernel memory at VMALLOCBASE.
+// --------------------------------------------------------------
+
+// A range of vmalloc address space that is in use, or lazily freed:
+// unmapped, but perhaps still cached in the TLB, and so not reusable
+// until the next vm_purge().
+struct VmArea {
+  uintptr_t va_start, va_end;
+  bool va_lazy;
+};
+
+// The areas, sorted by address, so vm_area_find() can binary search.
+#define VM_NAREAS	128
+static struct VmArea vm_areas[VM_NAREAS];
+static int vm_nareas;
+
+// Purge once this much address space is lazily freed.
+#define VM_LAZY_MAX	((KMAPBASE - VMALLOCBASE) / 4)
+static size_t vm_lazy_bytes;
+
+#define PTE_PPN(pte)	((ppn_t) (((pte) & ~PTE_NX) >> PGSHIFT))
+
+// Flush the TLB once for all lazily freed areas, and make their
+// address space reusable.
+static void
+vm_purge(void)
+{
+  int i, j;
+
+  tlbflush_global();
+  for (i = j = 0; i < vm_nareas; i++)
+    if (!vm_areas[i].va_lazy)
+      vm_areas[j++] = vm_areas[i];
+  vm_nareas = j;
+  vm_lazy_bytes = 0;
+}
+
+// Reserve 'size' bytes of address space aligned to 'align', first fit.
+// Returns the start, or 0 if there is no room.
+static uintptr_t
+vm_area_alloc(size_t size, size_t align)
+{
+  uintptr_t prev, start, limit;
+  int i, retry;
+
+  for (retry = 0; retry < 2; retry++) {
+    if (vm_nareas < VM_NAREAS) {
+      prev = VMALLOCBASE;
+      for (i = 0; i <= vm_nareas; i++) {
+        start = ROUNDUP(prev, align);
+        limit = i < vm_nareas ? vm_areas[i].va_start : KMAPBASE;
+        if (start <= limit && size <= limit - start) {
+          memmove(&vm_areas[i + 1], &vm_areas[i],
+                  (vm_nareas - i) * sizeof(vm_areas[0]));
+          vm_areas[i].va_start = start;
+          vm_areas[i].va_end = start + size;
+          vm_areas[i].va_lazy = 0;
+          vm_nareas++;
+          return start;
+        }
+        if (i < vm_nareas)
+          prev = vm_areas[i].va_end;
+      }
+    }
+    if (vm_lazy_bytes == 0)
+      break;
+    vm_purge();
+  }
+  return 0;
+}
+
+// The area holding address 'va', or NULL.
+static struct VmArea *
+vm_area_find(uintptr_t va)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = vm_nareas;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (va < vm_areas[mid].va_start)
+      hi = mid;
+    else if (va >= vm_areas[mid].va_end)
+      lo = mid + 1;
+    else
+      return &vm_areas[mid];
+  }
+  return NULL;
+}
+
+// The page table entry slot for 'va', in the page table its page
+// directory entry points to, if any; a page table entry is 4 or 8
+// bytes, so the slot comes back as a void pointer.
+static void *
+vm_pte_slot(uintptr_t va)
+{
+  uint64_t pde = kern_pde_get(va);
+  char *pt;
+
+  if (!(pde & PTE_P) || (pde & PTE_PS))
+    return NULL;
+  pt = KADDR(PTE_ADDR(pde));
+  if (paging_pae)
+    return pt + PAE_PTX(va) * sizeof(pae_pte_t);
+  return pt + PTX(va) * sizeof(pte_t);
+}
+
+// Map the page at 'va' with entry 'pte', first giving its page
+// directory entry a page table if it has none.  Page tables stay once
+// made, since other areas may come to share them.
+static int
+vm_map_page(uintptr_t va, uint64_t pte)
+{
+  struct Page *pp;
+  void *slot;
+
+  if (!(slot = vm_pte_slot(va))) {
+    if (!(pp = page_alloc(ALLOC_ZERO)))
+      return -E_NO_MEM;
+    pp->pp_ref++;
+    kern_pde_set(va, page2pa(pp) | PTE_P | PTE_W);
+    slot = vm_pte_slot(va);
+  }
+  if (paging_pae)
+    *(pae_pte_t *) slot = pte;
+  else
+    *(pte_t *) slot = pte;
+  return 0;
+}
+
+// Unmap [start, end) and free the pages behind it, without flushing
+// the TLB.
+static void
+vm_unmap(uintptr_t start, uintptr_t end)
+{
+  uintptr_t va;
+  uint64_t pde, pte;
+  void *slot;
+
+  for (va = start; va < end; ) {
+    pde = kern_pde_get(va);
+    if (pde & PTE_PS) {
+      page_free_order(&pages[PTE_PPN(pde)], LPGORDER);
+      kern_pde_set(va, 0);
+      va += LPGSIZE;
+      continue;
+    }
+    if ((slot = vm_pte_slot(va))) {
+      pte = paging_pae ? *(pae_pte_t *) slot : *(pte_t *) slot;
+      if (pte & PTE_P)
+        page_free(&pages[PTE_PPN(pte)]);
+      if (paging_pae)
+        *(pae_pte_t *) slot = 0;
+      else
+        *(pte_t *) slot = 0;
+    }
+    va += PGSIZE;
+  }
+}
+
+// Allocate 'size' bytes of kernel memory that is virtually, but not
+// necessarily physically, contiguous, and may come from highmem.
+// Requests of a large page or more are aligned to LPGSIZE and mapped
+// with large pages (PTE_PS) as far as physically contiguous blocks
+// allow, so they take few TLB entries; the rest is mapped with 4KB
+// pages.  Doesn't initialize the memory.  Returns NULL if out of
+// address space or memory.
+void *
+vmalloc(size_t size)
+{
+  uintptr_t start, va;
+  struct Page *pp;
+  uint64_t perm;
+
+  size = ROUNDUP(size, PGSIZE);
+  if (size == 0)
+    return NULL;
+  if (!(start = vm_area_alloc(size, size >= LPGSIZE ? LPGSIZE : PGSIZE)))
+    return NULL;
+
+  perm = PTE_P | PTE_W | PTE_G | boot_nx;
+  for (va = start; va < start + size; ) {
+    if (va % LPGSIZE == 0 && start + size - va >= LPGSIZE
+        && !(kern_pde_get(va) & PTE_P)
+        && (pp = page_alloc_order(LPGORDER, ALLOC_HIGHMEM))) {
+      kern_pde_set(va, (uint64_t) page2ppn(pp) << PGSHIFT | perm | PTE_PS);
+      va += LPGSIZE;
+      continue;
+    }
+    if (!(pp = page_alloc(ALLOC_HIGHMEM))
+        || vm_map_page(va, (uint64_t) page2ppn(pp) << PGSHIFT | perm) < 0) {
+      if (pp)
+        page_free(pp);
+      vfree((void *) start);
+      return NULL;
+    }
+    va += PGSIZE;
+  }
+  return (void *) start;
+}
+
+// Free memory from vmalloc().  The mappings go at once, but the TLB is
+// flushed, and the address space reused, only in batches.
+void
+vfree(void *va)
+{
+  struct VmArea *a;
+
+  if (!va)
+    return;
+  a = vm_area_find((uintptr_t) va);
+  if (!a || a->va_start != (uintptr_t) va || a->va_lazy)
+    panic("vfree: %p was not allocated by vmalloc", va);
+  vm_unmap(a->va_start, a->va_end);
+  a->va_lazy = 1;
+  vm_lazy_bytes += a->va_end - a->va_start;
+  if (vm_lazy_bytes >= VM_LAZY_MAX)
+    vm_purge();
+}
+
+// The physical page mapped at vmalloc address 'va', or 0 if none.
+static ppn_t
+vm_lookup(uintptr_t va)
+{
+  uint64_t pde, pte;
+  void *slot;
+
+  pde = kern_pde_get(va);
+  if (pde & PTE_PS)
+    return PTE_PPN(pde) + (va % LPGSIZE) / PGSIZE;
+  if (!(slot = vm_pte_slot(va)))
+    return 0;
+  pte = paging_pae ? *(pae_pte_t *) slot : *(pte_t *) slot;
+  return (pte & PTE_P) ? PTE_PPN(pte) : 0;
+}
+
+// Check vmalloc() with an area smaller than a large page, one exactly
+// a large page, and one a large page plus a tail of 4KB pages: each
+// page must be backed by an allocated page and keep what is written
+// to it, and the large ones must be large-page aligned.  Then vfree()
+// them all, purge, and do it again: the second round must reuse the
+// same address space and, with its page tables already there, give
+// back exactly the pages it took.
+void
+check_vmalloc(void)
+{
+  size_t size[3], nfree;
+  uintptr_t va[3], first[3], v;
+  int round, i;
+
+  size[0] = 3 * PGSIZE + 100;
+  size[1] = LPGSIZE;
+  size[2] = LPGSIZE + 2 * PGSIZE;
+  vm_purge();
+
+  for (round = 0; round < 2; round++) {
+    nfree = page_nfree();
+    for (i = 0; i < 3; i++) {
+      assert((va[i] = (uintptr_t) vmalloc(size[i])));
+      assert(size[i] < LPGSIZE || va[i] % LPGSIZE == 0);
+      if (round == 0)
+        first[i] = va[i];
+      assert(va[i] == first[i]);
+      for (v = va[i]; v < va[i] + size[i]; v += PGSIZE) {
+        assert(page_allocated(vm_lookup(v)));
+        *(uintptr_t *) v = v;
+        *(uintptr_t *) (v + PGSIZE - sizeof(uintptr_t)) = ~v;
+      }
+    }
+    assert(page_nfree() <= nfree - (size[1] + size[2]) / PGSIZE - 4);
+
+    // Read everything back once all three are mapped, so overlapping
+    // mappings would show.
+    for (i = 0; i < 3; i++)
+      for (v = va[i]; v < va[i] + size[i]; v += PGSIZE) {
+        assert(*(uintptr_t *) v == v);
+        assert(*(uintptr_t *) (v + PGSIZE - sizeof(uintptr_t)) == ~v);
+      }
+
+    for (i = 0; i < 3; i++) {
+      vfree((void *) va[i]);
+      for (v = va[i]; v < va[i] + size[i]; v += PGSIZE)
+        assert(vm_lookup(v) == 0);
+      assert(vm_area_find(va[i])->va_lazy);
+    }
+    vm_purge();
+    for (i = 0; i < 3; i++)
+      assert(!vm_area_find(va[i]));
+    if (round == 1)
+      assert(page_nfree() == nfree);
+  }
+
+  cprintf("check_vmalloc() succeeded!\n");
+}
+
+// Invalidate a TLB entry, but only if the page tables being
+// edited are the ones currently in use by the processor.
+// invlpg drops the entry even if it is global.
+void
+tlb_invalidate(pde_t *pgdir, void *va)
+{
+  if (PADDR(pgdir) == rcr3())
+    invlpg(va);
+}
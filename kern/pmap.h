@@ -0,0 +1,188 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_PMAP_H
+#define JOS_KERN_PMAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/memlayout.h>
+#include <inc/assert.h>
+
+#include <kern/cpu.h>
+
+extern size_t npages;			// Amount of physical memory (in pages)
+extern size_t npages_lowmem;		// Pages mapped at KERNBASE
+extern physaddr_t boot_mapped;		// [0, boot_mapped) is mapped at KERNBASE
+extern uint32_t paging_pae;		// PAE paging (chosen by entry.S)
+extern uint64_t boot_nx;		// PTE_NX if no-execute is enabled, else 0
+
+// Bytes mapped by one large page (a PTE_PS page directory entry) in
+// the current paging mode
+#define LPGSIZE		(paging_pae ? PAE_PTSIZE : PTSIZE)
+// ... and its order, as a block from page_alloc_order()
+#define LPGORDER	(paging_pae ? PAE_PDXSHIFT - PGSHIFT : PDXSHIFT - PGSHIFT)
+
+/* This macro takes a kernel virtual address -- an address that points above
+ * KERNBASE, where the machine's maximum 256MB of physical memory is mapped --
+ * and returns the corresponding physical address.  It panics if you pass it a
+ * non-kernel virtual address.
+ */
+#define PADDR(kva)						\
+({								\
+	physaddr_t __m_kva = (physaddr_t) (kva);		\
+	if (__m_kva < KERNBASE)					\
+		panic("PADDR called with invalid kva %08lx", __m_kva);\
+	__m_kva - KERNBASE;					\
+})
+
+/* This macro takes a physical address and returns the corresponding kernel
+ * virtual address.  It panics if you pass an invalid physical address, or
+ * one in highmem (use kmap() for those). */
+#define KADDR(pa)						\
+({								\
+	physaddr_t __m_pa = (pa);				\
+	uint32_t __m_ppn = PPN(__m_pa);				\
+	if (__m_ppn >= npages_lowmem)				\
+		panic("KADDR called with invalid pa %08lx", __m_pa);\
+	(void*) (__m_pa + KERNBASE);				\
+})
+
+// The buddy allocator hands out blocks of 1 << order pages, for order
+// less than PAGE_NORDER, each aligned to its own size.
+#define PAGE_NORDER	11		// up to 4MB blocks
+#define PAGE_NOTFREE	0xFF		// pp_order of pages not heading a free block
+#define PAGE_MAGAZINE	0xFE		// pp_order of free pages in a magazine
+#define PAGE_ZEROPOOL	0xFD		// pp_order of free pages in the zero pool
+#define PAGE_RESERVED	0xFC		// pp_order of pages page_init() kept back
+
+enum {
+	// For page_alloc, zero the returned physical page.
+	ALLOC_ZERO = 1<<0,
+	// The caller can take pages above the direct map (see kmap()).
+	ALLOC_HIGHMEM = 1<<1,
+};
+
+// Pages in the direct map and pages above it are allocated separately,
+// since only the former have a kernel virtual address of their own.
+enum {
+	ZONE_LOWMEM,
+	ZONE_HIGHMEM,
+	NZONES
+};
+
+struct PageZone {
+	const char *pz_name;
+	ppn_t pz_start, pz_end;		// the zone's pages [pz_start, pz_end)
+	struct Page_list pz_free[PAGE_NORDER];	// free blocks of each order
+	size_t pz_nfree[PAGE_NORDER];	// number of blocks on each list
+};
+
+// Each CPU keeps a magazine of free lowmem pages in front of the buddy
+// allocator, so single-page allocations and frees usually touch only
+// that CPU's own data.  The magazine is refilled from, and drained to,
+// the buddy allocator PAGEMAG_BATCH pages at a time.
+#define PAGEMAG_SIZE	64
+#define PAGEMAG_BATCH_ORDER	5
+#define PAGEMAG_BATCH	(1 << PAGEMAG_BATCH_ORDER)
+
+struct PageMag {
+	struct Page *pm_pages[PAGEMAG_SIZE];	// a stack: most recently freed on top
+	int pm_count;			// pages in pm_pages
+
+	// Statistics: operations served from the magazine alone (hits),
+	// out of all of them
+	uint64_t pm_alloc, pm_alloc_hit;
+	uint64_t pm_free, pm_free_hit;
+	uint32_t pm_refill, pm_drain;
+} __attribute__ ((__aligned__(CACHELINE)));	// a cache line of its own
+
+// While the kernel is idle, page_scrub() zero-fills free lowmem pages
+// and sets them aside, up to PAGE_ZERO_TARGET of them, for ALLOC_ZERO
+// requests.
+#define PAGE_ZERO_TARGET	256
+
+struct PageZeroPool {
+	struct Page_list zp_pages;	// free pages known to be zero-filled
+	uint32_t zp_count;		// pages on zp_pages
+
+	// Statistics: single-page ALLOC_ZERO requests served from the pool
+	// (hits) or zeroed on the spot (misses), and pages scrubbed
+	uint64_t zp_hit, zp_miss;
+	uint64_t zp_scrubbed;
+};
+
+// A bump allocator for structures set up early in boot, before the
+// page allocator, and perhaps only needed while booting.  Its pages
+// can be released in bulk afterwards.
+struct BootArena {
+	const char *ba_name;
+	char *ba_start, *ba_end;	// the arena's pages [ba_start, ba_end)
+	char *ba_next;			// first unallocated byte
+	uint32_t ba_color;		// cache colour of the next allocation
+	bool ba_released;
+	LIST_ENTRY(BootArena) ba_link;	// on the list of all arenas
+};
+
+// boot_arena_alloc() staggers coloured allocations over this many
+// cache lines (or alignment units, if larger).
+#define BOOT_NCOLORS	4
+
+extern struct Page *pages;
+extern ppn_t page_kern_end;
+extern struct PageZone page_zones[NZONES];
+extern struct PageMag page_mags[NCPU];
+extern struct PageZeroPool page_zero_pool;
+
+void	i386_detect_memory(void);
+void	page_init(void);
+void	check_page_alloc(void);
+void	boot_arena_init(struct BootArena *ba, const char *name, size_t size);
+void	*boot_arena_alloc(struct BootArena *ba, size_t n, size_t align,
+			  bool color);
+void	boot_arena_release(struct BootArena *ba);
+struct Page *page_alloc(int alloc_flags);
+struct Page *page_alloc_order(int order, int alloc_flags);
+void	page_free(struct Page *pp);
+void	page_free_order(struct Page *pp, int order);
+struct Page *page_alloc_contig(size_t n, size_t align, int alloc_flags);
+struct Page *page_alloc_contig_above(size_t n, ppn_t min);
+void	page_free_contig(struct Page *pp, size_t n);
+bool	page_allocated(ppn_t ppn);
+size_t	page_free_run_max(struct PageZone *z);
+int	page_scrub(void);
+void	*kmap(ppn_t ppn);
+void	kunmap(void *va);
+void	*vmalloc(size_t size);
+void	vfree(void *va);
+void	check_vmalloc(void);
+void	tlb_invalidate(pde_t *pgdir, void *va);
+
+static inline ppn_t
+page2ppn(struct Page *pp)
+{
+	return pp - pages;
+}
+
+// Only for pages below 4GB on i386; use page2ppn() for the rest.
+static inline physaddr_t
+page2pa(struct Page *pp)
+{
+	return (physaddr_t) page2ppn(pp) << PGSHIFT;
+}
+
+static inline struct Page*
+pa2page(physaddr_t pa)
+{
+	if (PPN(pa) >= npages)
+		panic("pa2page called with invalid pa");
+	return &pages[PPN(pa)];
+}
+
+static inline void*
+page2kva(struct Page *pp)
+{
+	return KADDR(page2pa(pp));
+}
+
+#endif /* !JOS_KERN_PMAP_H */
@@ -0,0 +1,239 @@
+// Kernel slab allocator, and the kernel's malloc() and free().
+//
+// Objects of each cache are carved out of one-page slabs, which come
+// from the page allocator and go back to it once they are empty.
+// As with pages (see page_alloc_order()), each CPU keeps some free
+// objects of each cache to itself, so most allocations and frees
+// don't touch the slabs at all.
+
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/malloc.h>
+
+#include <kern/pmap.h>
+#include <kern/slab.h>
+
+// Objects are at least this aligned, which suits any C type.
+#define SLAB_MINALIGN	(2 * sizeof(void *))
+
+// malloc() takes requests up to 1 << KMALLOC_MAXSHIFT bytes from
+// power-of-two size classes.  Larger ones get whole pages, with a
+// struct Slab header in front (sl_cache == NULL) so that free() can
+// tell them apart.
+#define KMALLOC_MINSHIFT	4
+#define KMALLOC_MAXSHIFT	10
+#define KMALLOC_NCLASS		(KMALLOC_MAXSHIFT - KMALLOC_MINSHIFT + 1)
+#define KMALLOC_HDRSIZE		ROUNDUP(sizeof(struct Slab), SLAB_MINALIGN)
+
+struct KmemCache_list kmem_caches;
+
+static struct KmemCache kmem_cache_cache;	// where KmemCaches come from
+static struct KmemCache kmalloc_caches[KMALLOC_NCLASS];
+static const char *const kmalloc_names[KMALLOC_NCLASS] = {
+  "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+  "kmalloc-256", "kmalloc-512", "kmalloc-1024",
+};
+
+static void
+kmem_cache_setup(struct KmemCache *kc, const char *name, size_t size,
+                 size_t align, void (*ctor)(void *))
+{
+  memset(kc, 0, sizeof(*kc));
+  if (align < SLAB_MINALIGN)
+    align = SLAB_MINALIGN;
+  assert((align & (align - 1)) == 0);
+  kc->kc_name = name;
+  kc->kc_ctor = ctor;
+  // Without a constructor, a free object's contents don't matter and
+  // the link can overlay them.  With one, it goes after the object.
+  size = ROUNDUP(MAX(size, sizeof(void *)), sizeof(void *));
+  kc->kc_linkoff = ctor ? size : 0;
+  kc->kc_size = ROUNDUP(size + (ctor ? sizeof(void *) : 0), align);
+  kc->kc_offset = ROUNDUP(sizeof(struct Slab), align);
+  assert(kc->kc_offset + kc->kc_size <= PGSIZE);
+  kc->kc_perslab = (PGSIZE - kc->kc_offset) / kc->kc_size;
+  LIST_INSERT_HEAD(&kmem_caches, kc, kc_link);
+}
+
+// Set up the cache of caches and malloc()'s size classes.
+void
+slab_init(void)
+{
+  int i;
+
+  kmem_cache_setup(&kmem_cache_cache, "kmem_cache",
+                   sizeof(struct KmemCache), CACHELINE, NULL);
+  for (i = 0; i < KMALLOC_NCLASS; i++)
+    kmem_cache_setup(&kmalloc_caches[i], kmalloc_names[i],
+                     1 << (KMALLOC_MINSHIFT + i), 0, NULL);
+}
+
+// Create a cache of objects of 'size' bytes, aligned to 'align' (a
+// power of two, or 0 for the default), which must fit in a slab.
+// 'ctor', if not NULL, constructs each object when its slab is made.
+// Returns NULL if the objects are too big or memory is short.
+struct KmemCache *
+kmem_cache_create(const char *name, size_t size, size_t align,
+                  void (*ctor)(void *))
+{
+  struct KmemCache *kc;
+
+  if (size == 0 || size > PGSIZE / 2)
+    return NULL;
+  if (!(kc = kmem_cache_alloc(&kmem_cache_cache)))
+    return NULL;
+  kmem_cache_setup(kc, name, size, align, ctor);
+  return kc;
+}
+
+static void **
+obj_link(struct KmemCache *kc, void *obj)
+{
+  return (void **) ((char *) obj + kc->kc_linkoff);
+}
+
+// Make a new slab for 'kc', with all its objects constructed and free.
+static struct Slab *
+slab_grow(struct KmemCache *kc)
+{
+  struct Page *pp;
+  struct Slab *sl;
+  char *obj;
+  uint32_t i;
+
+  if (!(pp = page_alloc(0)))
+    return NULL;
+  sl = page2kva(pp);
+  sl->sl_cache = kc;
+  sl->sl_free = NULL;
+  sl->sl_inuse = 0;
+  sl->sl_order = 0;
+  // Link the objects in address order.
+  for (i = kc->kc_perslab; i-- > 0; ) {
+    obj = (char *) sl + kc->kc_offset + i * kc->kc_size;
+    if (kc->kc_ctor)
+      kc->kc_ctor(obj);
+    *obj_link(kc, obj) = sl->sl_free;
+    sl->sl_free = obj;
+  }
+  LIST_INSERT_HEAD(&kc->kc_partial, sl, sl_link);
+  kc->kc_nslabs++;
+  return sl;
+}
+
+// Take a free object from one of kc's slabs.
+static void *
+slab_get(struct KmemCache *kc)
+{
+  struct Slab *sl;
+  void *obj;
+
+  if (!(sl = LIST_FIRST(&kc->kc_partial)) && !(sl = slab_grow(kc)))
+    return NULL;
+  obj = sl->sl_free;
+  sl->sl_free = *obj_link(kc, obj);
+  sl->sl_inuse++;
+  if (!sl->sl_free) {
+    LIST_REMOVE(sl, sl_link);
+    LIST_INSERT_HEAD(&kc->kc_full, sl, sl_link);
+  }
+  return obj;
+}
+
+// Return 'obj' to its slab.  A slab that becomes empty goes back to
+// the page allocator, unless it is the cache's only partial slab.
+static void
+slab_put(struct KmemCache *kc, void *obj)
+{
+  struct Slab *sl = ROUNDDOWN(obj, PGSIZE);
+
+  if (sl->sl_cache != kc || sl->sl_inuse == 0)
+    panic("slab_put: %p is not an allocated %s object", obj, kc->kc_name);
+  if (!sl->sl_free) {
+    LIST_REMOVE(sl, sl_link);
+    LIST_INSERT_HEAD(&kc->kc_partial, sl, sl_link);
+  }
+  *obj_link(kc, obj) = sl->sl_free;
+  sl->sl_free = obj;
+  sl->sl_inuse--;
+  if (sl->sl_inuse == 0
+      && (LIST_FIRST(&kc->kc_partial) != sl || LIST_NEXT(sl, sl_link))) {
+    LIST_REMOVE(sl, sl_link);
+    kc->kc_nslabs--;
+    page_free(pa2page(PADDR(sl)));
+  }
+}
+
+// Allocate an object from cache 'kc'.  Returns NULL if out of memory.
+void *
+kmem_cache_alloc(struct KmemCache *kc)
+{
+  struct KmemCpuCache *cc = &kc->kc_cpu[cpunum()];
+  void *obj;
+
+  cc->cc_alloc++;
+  if (cc->cc_count > 0)
+    cc->cc_alloc_hit++;
+  else
+    while (cc->cc_count < KMEM_CPU_BATCH && (obj = slab_get(kc)))
+      cc->cc_objs[cc->cc_count++] = obj;
+  if (cc->cc_count == 0)
+    return NULL;
+  return cc->cc_objs[--cc->cc_count];
+}
+
+// Free 'obj', from kmem_cache_alloc(kc).
+void
+kmem_cache_free(struct KmemCache *kc, void *obj)
+{
+  struct KmemCpuCache *cc = &kc->kc_cpu[cpunum()];
+  int i;
+
+  if (cc->cc_count == KMEM_CPU_SIZE) {
+    // Return the coldest half to the slabs.
+    for (i = 0; i < KMEM_CPU_BATCH; i++)
+      slab_put(kc, cc->cc_objs[i]);
+    cc->cc_count -= KMEM_CPU_BATCH;
+    memmove(cc->cc_objs, cc->cc_objs + KMEM_CPU_BATCH,
+            cc->cc_count * sizeof(cc->cc_objs[0]));
+  }
+  cc->cc_objs[cc->cc_count++] = obj;
+}
+
+void *
+malloc(size_t size)
+{
+  struct Page *pp;
+  struct Slab *sl;
+  int i, order;
+
+  if (size == 0)
+    return NULL;
+  for (i = 0; i < KMALLOC_NCLASS; i++)
+    if (size <= kmalloc_caches[i].kc_size)
+      return kmem_cache_alloc(&kmalloc_caches[i]);
+
+  for (order = 0; order < PAGE_NORDER; order++)
+    if (size <= ((size_t) PGSIZE << order) - KMALLOC_HDRSIZE)
+      break;
+  if (order == PAGE_NORDER || !(pp = page_alloc_order(order, 0)))
+    return NULL;
+  sl = page2kva(pp);
+  sl->sl_cache = NULL;
+  sl->sl_order = order;
+  return (char *) sl + KMALLOC_HDRSIZE;
+}
+
+void
+free(void *addr)
+{
+  struct Slab *sl;
+
+  if (!addr)
+    return;
+  sl = ROUNDDOWN(addr, PGSIZE);
+  if (sl->sl_cache)
+    kmem_cache_free(sl->sl_cache, addr);
+  else
+    page_free_order(pa2page(PADDR(sl)), sl->sl_order);
+}
@@ -0,0 +1,67 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_SLAB_H
+#define JOS_KERN_SLAB_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/queue.h>
+
+#include <kern/cpu.h>
+
+// A slab is one page, holding a struct Slab and then the objects.
+// Free objects are linked through a pointer at kc_linkoff in each.
+struct Slab {
+	struct KmemCache *sl_cache;	// NULL for a large malloc() block
+	LIST_ENTRY(Slab) sl_link;	// on sl_cache's partial or full list
+	void *sl_free;			// first free object
+	uint32_t sl_inuse;		// objects allocated (or in a CPU cache)
+	uint32_t sl_order;		// large blocks: 1 << sl_order pages
+};
+
+LIST_HEAD(Slab_list, Slab);
+
+// Each CPU keeps up to KMEM_CPU_SIZE free objects of each cache, and
+// moves KMEM_CPU_BATCH at a time between them and the slabs.
+#define KMEM_CPU_SIZE	16
+#define KMEM_CPU_BATCH	(KMEM_CPU_SIZE / 2)
+
+struct KmemCpuCache {
+	void *cc_objs[KMEM_CPU_SIZE];	// a stack: most recently freed on top
+	int cc_count;
+	uint32_t cc_alloc, cc_alloc_hit;	// allocations, and those served here
+} __attribute__ ((__aligned__(CACHELINE)));	// a cache line of its own
+
+// A cache of equal-sized objects.  With a constructor, every object is
+// constructed once, when its slab is created, and must be freed back
+// in its constructed state.
+struct KmemCache {
+	const char *kc_name;
+	size_t kc_size;			// object size, rounded up to the alignment
+	size_t kc_offset;		// offset of the first object in a slab
+	size_t kc_linkoff;		// offset of the free list link in an object
+	uint32_t kc_perslab;		// objects per slab
+	void (*kc_ctor)(void *obj);
+
+	struct Slab_list kc_partial;	// slabs with some free objects
+	struct Slab_list kc_full;	// slabs with none
+	uint32_t kc_nslabs;		// slabs on both lists
+	LIST_ENTRY(KmemCache) kc_link;	// on the list of all caches
+
+	struct KmemCpuCache kc_cpu[NCPU];
+};
+
+LIST_HEAD(KmemCache_list, KmemCache);
+
+// All caches, for the slabinfo monitor command
+extern struct KmemCache_list kmem_caches;
+
+void	slab_init(void);
+struct KmemCache *kmem_cache_create(const char *name, size_t size,
+				    size_t align, void (*ctor)(void *));
+void	*kmem_cache_alloc(struct KmemCache *kc);
+void	kmem_cache_free(struct KmemCache *kc, void *obj);
+
+#endif	// !JOS_KERN_SLAB_H
@@ -0,0 +1,60 @@
+/* See COPYRIGHT for copyright information. */
+
+// Time stamp counter support: calibration against the PIT, and the
+// kernel's end of the boot timeline started by the boot loader.
+
+#include <inc/x86.h>
+#include <inc/memlayout.h>
+
+#include <kern/tsc.h>
+#include <kern/bootinfo.h>
+
+#define PIT_HZ		1193182
+#define PIT_CH2		0x42		// channel 2 data port
+#define PIT_MODE	0x43
+#define PIT_GATE	0x61		// bit 0: ch. 2 gate; bit 5: ch. 2 output
+
+#define CALIBRATE_MS	2
+
+// Return the TSC frequency in kHz.  The first call measures it by
+// counting TSC ticks while PIT channel 2 counts down CALIBRATE_MS
+// milliseconds, so it costs that much once.
+uint32_t
+tsc_khz(void)
+{
+  static uint32_t khz;
+  uint32_t latch = PIT_HZ * CALIBRATE_MS / 1000;
+  uint64_t t0, t1;
+
+  if (khz)
+    return khz;
+
+  // Gate channel 2 on with the speaker off, then load it in mode 0
+  // (output goes high at terminal count).
+  outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);
+  outb(PIT_MODE, 0xB0);         // channel 2, lobyte/hibyte, mode 0
+  outb(PIT_CH2, latch & 0xFF);
+  outb(PIT_CH2, latch >> 8);
+  t0 = read_tsc();
+  while (!(inb(PIT_GATE) & 0x20))
+    /* do nothing */ ;
+  t1 = read_tsc();
+
+  khz = (t1 - t0) / CALIBRATE_MS;
+  return khz;
+}
+
+// Append a point to the boot timeline, if we have boot information.
+void
+boot_stamp(uint32_t id, uint32_t arg)
+{
+  struct Bootinfo *bi = bootinfo;
+  struct Bootstamp *bs;
+
+  if (!bi || bi->bi_nstamp >= BI_NSTAMP)
+    return;
+  bs = &bi->bi_stamps[bi->bi_nstamp++];
+  bs->bs_tsc = read_tsc();
+  bs->bs_id = id;
+  bs->bs_arg = arg;
+}
@@ -0,0 +1,14 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TSC_H
+#define JOS_KERN_TSC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+uint32_t tsc_khz(void);
+void boot_stamp(uint32_t id, uint32_t arg);
+
+#endif	// !JOS_KERN_TSC_H
@@ -0,0 +1,75 @@
+// Decoder for the LZ4 block format, used to unpack the compressed
+// kernel image (see kern/mkimg.c for the encoder).
+//
+// A block is a series of sequences.  Each starts with a token byte
+// whose high nibble is a literal count and whose low nibble is a match
+// length minus 4; a nibble of 15 is extended by following bytes, each
+// adding up to 255.  The literals come next, then a 2-byte little-endian
+// offset back into the output where the match is copied from.  The last
+// sequence has literals only.
+//
+// This must stay free of other library calls: the boot loader uses it.
+
+#include <inc/lz4.h>
+
+// Read an extended length that follows a nibble of 15; returns -1 if
+// the input runs out.
+static int
+lz4_len(const uint8_t **ipp, const uint8_t *iend, size_t *lenp)
+{
+  const uint8_t *ip = *ipp;
+  uint8_t b;
+
+  do {
+    if (ip >= iend)
+      return -1;
+    b = *ip++;
+    *lenp += b;
+  } while (b == 255);
+  *ipp = ip;
+  return 0;
+}
+
+int
+lz4_decompress(const void *src, size_t srclen, void *dst, size_t dstlen)
+{
+  const uint8_t *ip = src, *iend = ip + srclen;
+  uint8_t *op = dst, *oend = op + dstlen;
+  const uint8_t *match;
+  size_t len, off;
+  uint8_t token;
+
+  while (ip < iend) {
+    token = *ip++;
+
+    // literals
+    len = token >> 4;
+    if (len == 15 && lz4_len(&ip, iend, &len) < 0)
+      return -1;
+    if (len > (size_t) (iend - ip) || len > (size_t) (oend - op))
+      return -1;
+    while (len-- > 0)
+      *op++ = *ip++;
+    if (ip == iend)
+      break;    // the last sequence has no match
+
+    // match
+    if (iend - ip < 2)
+      return -1;
+    off = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (off == 0 || off > (size_t) (op - (uint8_t *) dst))
+      return -1;
+    len = token & 15;
+    if (len == 15 && lz4_len(&ip, iend, &len) < 0)
+      return -1;
+    len += 4;
+    if (len > (size_t) (oend - op))
+      return -1;
+    // byte by byte: the match may overlap the bytes it produces
+    match = op - off;
+    while (len-- > 0)
+      *op++ = *match++;
+  }
+  return op - (uint8_t *) dst;
+}
@@ -25,6 +25,7 @@ static const char *const error_string[MAXERROR] = {
   [E_NO_MEM] = "out of memory",
   [E_NO_FREE_ENV] = "out of environments",
   [E_FAULT] = "segmentation fault",
+  [E_IO] = "I/O error",
 };
 
 /*
@@ -79,13 +80,18 @@ void printfmt(void (*putch) (int, void *), void *putdat, const char *fmt, ...);
 
 void
 vprintfmt(void (*putch) (int, void *), void *putdat, const char *fmt,
-          va_list ap)
+          va_list ap0)
 {
   register const char *p;
   register int ch, err;
   unsigned long long num;
   int base, lflag, width, precision, altflag;
   char padc;
+  va_list ap;
+
+  // On x86-64, va_list is an array type, so the parameter is really a
+  // pointer, and &ap0 would not be a va_list *.  Work on a copy.
+  va_copy(ap, ap0);
 
   while (1) {
     while ((ch = *(unsigned char *)fmt++) != '%') {